@@ -14,14 +14,16 @@ void usage()
 	std::cerr << R"XYZ(
 Usage:
 
-  kmeans --input inputfile.csv --output outputfile.csv --k numclusters --repetitions numrepetitions --seed seed [--blocks numblocks] [--threads numthreads] [--trace clusteridxdebug.csv] [--centroidtrace centroiddebug.csv]
+  kmeans --input inputfile.csv --output outputfile.csv --k numclusters --repetitions numrepetitions --seed seed [--blocks numblocks] [--threads numthreads] [--trace clusteridxdebug.csv] [--centroidtrace centroiddebug.csv] [--cache 0|1] [--incremental N] [--engine lloyd|elkan|hamerly|yinyang|kdtree|gemm] [--batch N] [--rng counter|legacy] [--init random|kmeans++|kmeans-parallel] [--mpimode auto|repetitions|data] [--threadsperrank N] [--mpischedule static|dynamic] [--backend auto|serial|openmp|mpi|cuda] [--tunecache file] [--pin none|compact|scatter] [--numa auto|firsttouch|interleave|none]
 
 Arguments:
 
  --input:
  
    Specifies input CSV file, number of rows represents number of points, the
-   number of columns is the dimension of each point.
+   number of columns is the dimension of each point. A binary dataset file
+   (see 'kmeans_convert') can be used as well, it is memory mapped and used
+   without parsing or copying.
 
  --output:
 
@@ -57,6 +59,99 @@ Arguments:
    Specifies a seed for the random number generator, to be able to get 
    reproducible results.
 
+ --init:
+
+   How the initial centroids of each repetition are chosen. 'random' (the
+   default) picks k points of the dataset. 'kmeans++' picks them one by one,
+   each with a probability proportional to its squared distance to the closest
+   centroid picked so far, which spreads them over the clusters and usually
+   needs fewer steps and repetitions. 'kmeans-parallel' (k-means||) samples
+   many such points per pass over the dataset in a few rounds, and then picks
+   k of them with k-means++; with MPI all processes share these passes.
+
+ --backend:
+
+   The implementation that runs the repetitions. Every executable runs the
+   one it was built for by default; 'kmeans' contains 'serial', 'openmp' and
+   'mpi' and defaults to 'auto'. 'auto' uses 'mpi' when started by mpirun and
+   'openmp' otherwise, and lets the auto-tuner choose the engine, the number
+   of threads (per process for 'mpi') and whether the threads or processes
+   each take repetitions or share the points of every repetition (--batch,
+   --mpimode). Those of --engine, --threads, --batch, --mpimode and
+   --threadsperrank that are given are kept, the tuner only chooses the
+   others. The tuner times a few steps of the engines on a sample of the
+   dataset. The results do not depend on the choice ('kdtree' is never
+   chosen).
+
+ --tunecache:
+
+   A file in which '--backend auto' keeps its choices, for later runs with the
+   same numbers of points, dimensions, clusters, repetitions, processes and
+   cores. Without it, every run calibrates again. It is not used when any of
+   the settings the tuner chooses are given.
+
+ --pin:
+
+   Only for the OpenMP version. 'compact' pins the threads to the CPUs of
+   the first NUMA node, then those of the next one, and so on; 'scatter'
+   spreads them over the nodes in turn, which gives every thread more memory
+   bandwidth when there are fewer threads than CPUs. 'none' (the default)
+   leaves the threads to the operating system. The NUMA nodes and their
+   CPUs are reported on stderr at startup.
+
+ --numa:
+
+   Only for the OpenMP version. 'firsttouch' copies the points to memory
+   that the threads write first, each the blocks of points it processes, so
+   that their pages end up on the NUMA node of that thread instead of all
+   on the node of the thread that read the file. This needs '--batch',
+   where every thread gets the same blocks in every step; without it, a
+   warning is printed and the points stay where they are. 'interleave'
+   spreads the pages of the copy over the NUMA nodes in turn, so that
+   threads that each read all points, as without '--batch', use the memory
+   bandwidth of every node. 'auto' (the default) uses 'firsttouch' with
+   '--batch' and 'interleave' without it when there are several NUMA nodes
+   and threads, 'none' never copies. Use it together with '--pin'; the
+   results are the same.
+
+ --mpimode:
+
+   Only for the MPI version. 'repetitions' divides the repetitions over the
+   processes, each running its repetitions on all points. 'data' runs every
+   repetition on all processes, each assigning a part of the points, and
+   combines their per-cluster sums with MPI_Allreduce after every step; this
+   makes a single repetition faster and can use more processes than there
+   are repetitions. With 'data', a process only keeps its part of the points
+   of a CSV file in memory (not with '--engine kdtree' or '--backend auto').
+   'auto' (the default) uses 'data' when there are fewer repetitions than
+   processes. The results are the same.
+
+ --mpischedule:
+
+   Only for the MPI version, in the repetition mode. 'static' (the default)
+   divides the repetitions in fixed blocks up front. 'dynamic' gives every
+   process a next repetition as soon as it is done with the last one, from a
+   shared counter in an MPI window on rank 0. This needs MPI windows, which
+   not every setup supports (e.g. Open MPI over plain TCP); without them,
+   'static' is used and a note is printed. The results are the same.
+
+ --threadsperrank:
+
+   Only for the hybrid MPI+OpenMP version (kmeans_hybrid). The number of
+   OpenMP threads every MPI process uses, for its repetitions or for its part
+   of the points in the data-parallel mode (see --mpimode). '--threads' still
+   gives the number of processes, so one process per node or NUMA domain with
+   a thread per core uses all cores with one copy of the dataset per process.
+
+ --rng:
+
+   The random number generator that picks the initial centroids. The default,
+   'counter', gives every repetition its own stream of a counter based
+   generator, so the centroids of a repetition do not depend on the others
+   and are picked with a few draws each. 'legacy' uses the generator of
+   earlier versions, which walks over all points for every repetition, to
+   reproduce their results for the same seed.
+
  --trace:
 
    Debug option - do NOT use this when timing your program!
@@ -78,6 +173,51 @@ Arguments:
    file first logs the randomly chosen centroids from the input data, and for
    each step in the sequence, the updated centroids are logged. The program 
    'visualize_centroids.py' can be used to visualize how the centroids change.
+
+ --cache:
+
+   If 1, a parsed CSV input file is also stored in the binary dataset format
+   as 'inputfile.csv.bin'. Subsequent runs load that file instead of parsing
+   the CSV file again, as long as the size and modification time of the CSV
+   file are unchanged. Useful when the same input is run many times, e.g. by
+   the 'thread_difference.py' and 'core_difference.py' scripts.
+
+ --engine:
+
+   How the closest centroid of every point is found. 'lloyd' (the default)
+   compares every point with every centroid. 'elkan' keeps bounds on the
+   distances between the points and the centroids, and uses the triangle
+   inequality to skip most comparisons once the centroids only move a little.
+   This pays off for larger numbers of clusters, at the cost of memory for
+   numpoints x numclusters bounds. 'hamerly' keeps only two bounds per point
+   and skips all comparisons for a point at once, which suits low-dimensional
+   data with a moderate number of clusters. 'yinyang' groups the centroids
+   and first rules out whole groups, which suits a large number of clusters
+   (hundreds). 'kdtree' builds a kd-tree over the points once and assigns
+   whole subtrees to a centroid at once, which suits many points with few
+   dimensions. 'gemm' computes the distances of tiles of points to all
+   centroids like a matrix product, which suits points with many (32 or
+   more) dimensions. All engines give the same clusters and steps, except
+   that the centroids of 'kdtree' are summed in another order, which can
+   change the last bits of the results. The number of distance calculations
+   the engines skipped is logged after the results.
+
+ --batch:
+
+   Only for the OpenMP version. If N > 1, the repetitions run in batches of N
+   that advance in lockstep: every step, each block of points is assigned for
+   all repetitions in the batch while it is in cache, so the dataset is read
+   once per step for the whole batch instead of once per repetition. The
+   threads share the blocks of points instead of taking a repetition each.
+   Repetitions leave the batch as they converge. The results are the same.
+
+ --incremental:
+
+   If N > 0, the centroids are updated incrementally: a step only subtracts
+   the points that changed cluster from their old cluster and adds them to
+   their new one, and only every N-th step sums all points again. This is
+   faster when few points move per step, but the results are no longer
+   bit-identical to the default (0), which recomputes every step.
    
 )XYZ";
 	exit(-1);
@@ -93,6 +233,9 @@ int mainCxx(const std::vector<std::string> &args)
 
 	int numClusters = -1, repetitions = -1;
 	int numBlocks = 1, numThreads = 1;
+	bool useDataCache = false;
+	bool legacyRng = false;
+	KMeansOptions options;
 	for (int i = 0 ; i < args.size() ; i += 2)
 	{
 		if (args[i] == "--input")
@@ -112,7 +255,94 @@ int mainCxx(const std::vector<std::string> &args)
 		else if (args[i] == "--blocks")
 			numBlocks = stoi(args[i+1]);
 		else if (args[i] == "--threads")
+		{
 			numThreads = stoi(args[i+1]);
+			options.threadsGiven = true;
+		}
+		else if (args[i] == "--cache")
+			useDataCache = (stoi(args[i+1]) != 0);
+		else if (args[i] == "--incremental")
+			options.incrementalUpdateInterval = stoi(args[i+1]);
+		else if (args[i] == "--batch")
+		{
+			options.repetitionBatchSize = stoi(args[i+1]);
+			options.batchGiven = true;
+		}
+		else if (args[i] == "--rng")
+		{
+			if (args[i+1] != "counter" && args[i+1] != "legacy")
+			{
+				std::cerr << "Unknown random number generator '" << args[i+1] << "'" << std::endl;
+				return -1;
+			}
+			legacyRng = (args[i+1] == "legacy");
+		}
+		else if (args[i] == "--init")
+		{
+			if (!parseInitName(args[i+1], options.init))
+			{
+				std::cerr << "Unknown initialisation '" << args[i+1] << "'" << std::endl;
+				return -1;
+			}
+		}
+		else if (args[i] == "--mpimode")
+		{
+			if (!parseMPIModeName(args[i+1], options.mpiMode))
+			{
+				std::cerr << "Unknown MPI mode '" << args[i+1] << "'" << std::endl;
+				return -1;
+			}
+			options.mpiModeGiven = true;
+		}
+		else if (args[i] == "--mpischedule")
+		{
+			if (args[i+1] != "static" && args[i+1] != "dynamic")
+			{
+				std::cerr << "Unknown MPI schedule '" << args[i+1] << "'" << std::endl;
+				return -1;
+			}
+			options.dynamicMPISchedule = (args[i+1] == "dynamic");
+		}
+		else if (args[i] == "--backend")
+		{
+			if (!parseBackendName(args[i+1], options.backend))
+			{
+				std::cerr << "Unknown backend '" << args[i+1] << "'" << std::endl;
+				return -1;
+			}
+		}
+		else if (args[i] == "--pin")
+		{
+			if (!parsePinningName(args[i+1], options.pinning))
+			{
+				std::cerr << "Unknown pinning '" << args[i+1] << "'" << std::endl;
+				return -1;
+			}
+		}
+		else if (args[i] == "--numa")
+		{
+			if (!parseNumaPlacementName(args[i+1], options.numaPlacement))
+			{
+				std::cerr << "Unknown NUMA placement '" << args[i+1] << "'" << std::endl;
+				return -1;
+			}
+		}
+		else if (args[i] == "--tunecache")
+			options.tuningCacheFileName = args[i+1];
+		else if (args[i] == "--threadsperrank")
+		{
+			options.threadsPerRank = stoi(args[i+1]);
+			options.threadsPerRankGiven = true;
+		}
+		else if (args[i] == "--engine")
+		{
+			if (!parseEngineName(args[i+1], options.engine))
+			{
+				std::cerr << "Unknown engine '" << args[i+1] << "'" << std::endl;
+				return -1;
+			}
+			options.engineGiven = true;
+		}
 		else
 		{
 			std::cerr << "Unknown argument '" << args[i] << "'" << std::endl;
@@ -123,10 +353,11 @@ int mainCxx(const std::vector<std::string> &args)
 	if (inputFileName.length() == 0 || outputFileName.length() == 0 || numClusters < 1 || repetitions < 1 || seed == 0)
 		usage();
 
-	Rng rng(seed);
+	Rng rng(seed, legacyRng);
 
 	KMeansArgs kmeanargs{rng, inputFileName, outputFileName, numClusters, repetitions,
-			      numBlocks, numThreads, centroidTraceFileName, clusterTraceFileName};
+			      numBlocks, numThreads, centroidTraceFileName, clusterTraceFileName,
+			      useDataCache, options};
 
 	return kmeans(kmeanargs);
 }
@@ -23,6 +23,11 @@ will be transformed into
 
   mpirun -n 2 ./kmeans_mpi --input in.csv --output out.csv --k 3 --repetitions 4 --threads 2
 
+Extra options for 'mpirun' can be set in the MPIRUN_ARGS environment variable,
+e.g. to run the hybrid executable with one process per NUMA domain (Open MPI):
+
+  MPIRUN_ARGS="--map-by numa --bind-to numa" EXECUTABLE=./kmeans_hybrid ./mpiwrapper.sh ... --threads 2 --threadsperrank 8
+
 Together with the compare.py script you could do something like
 
   EXECUTABLE=./kmeans_mpi ./compare.py ./kmeans_serial ./mpiwrapper.sh --input in.csv --output out.csv --k 3 --repetitions 4 --threads 2 --seed 12345
@@ -53,5 +58,5 @@ while [ "$#" != 0 ] ; do
 	fi
 done
 
-mpirun -n $NUMNODES $EXE $NEWARGS
+mpirun $MPIRUN_ARGS -n $NUMNODES $EXE $NEWARGS
 
@@ -0,0 +1,298 @@
+#include "autotune.h"
+#include "lloyd_step.h"
+#include "timer.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+
+// Points the engines are timed on, at least a few per cluster
+const size_t samplePoints = 16384;
+const size_t samplePointsPerCluster = 4;
+
+// Steps every engine runs on the sample, unless it converges before
+const int calibrationSteps = 8;
+
+// Steps a repetition is assumed to take, to estimate the time of the run
+const int assumedSteps = 20;
+
+// Elkan's bounds of the whole dataset may take at most this much memory
+const double maxElkanBytes = 1024.0 * 1024 * 1024;
+
+// Another engine replaces Lloyd only if it takes at most this part of its
+// time, so that noise in the timings does not decide
+const double minGain = 0.9;
+
+// Work per thread below which more threads do not pay off
+const double minSecondsPerThread = 0.01;
+
+// KMeansEngine::KdTree is left out, its results can differ in the last bits
+const KMeansEngine candidates[] = {KMeansEngine::Lloyd, KMeansEngine::Elkan,
+                                   KMeansEngine::Hamerly, KMeansEngine::Yinyang,
+                                   KMeansEngine::Gemm};
+
+std::string problemKey(const TuningProblem &problem) {
+    std::ostringstream key;
+    key << problem.numPoints << "," << problem.pointSize << ","
+        << problem.numClusters << "," << problem.repetitions << ","
+        << backendName(problem.backend) << "," << problem.numProcesses << ","
+        << problem.coresPerProcess;
+    return key.str();
+}
+
+// The memory Elkan's bounds take in a process: n*k doubles for every
+// repetition that runs at once. The threads are not chosen yet, unless they
+// are fixed, so all cores are counted.
+double elkanBytes(const TuningProblem &problem, const TuningFixed &fixed) {
+    const int threads =
+        fixed.numThreads ? fixed.given.numThreads : problem.coresPerProcess;
+    double points = problem.numPoints;
+    int concurrent = 1;
+    switch (problem.backend) {
+    case KMeansBackend::OpenMP:
+        // a batch keeps the bounds of all its repetitions
+        if (fixed.splitPoints && fixed.repetitionBatchSize > 1)
+            concurrent =
+                std::min(problem.repetitions, fixed.repetitionBatchSize);
+        else
+            concurrent = std::min(problem.repetitions, threads);
+        break;
+    case KMeansBackend::MPI:
+        if (fixed.splitPoints ? fixed.given.splitPoints
+                              : problem.repetitions < problem.numProcesses) {
+            points /= problem.numProcesses;
+        } else {
+            const int repetitionsPerProcess =
+                (problem.repetitions + problem.numProcesses - 1) /
+                problem.numProcesses;
+            concurrent = std::min(repetitionsPerProcess, threads);
+        }
+        break;
+    default:
+        break;
+    }
+    return 8.0 * points * problem.numClusters * concurrent;
+}
+
+// Runs at most calibrationSteps steps of the engine on the sample, returns
+// the time they took
+double timeEngine(KMeansEngine engine, const double *sample, size_t numPoints,
+                  const TuningProblem &problem, const KMeansKernels &kernels,
+                  const CentroidMatrix &initialCentroids) {
+    KMeansOptions options;
+    options.engine = engine;
+    const std::unique_ptr<const EngineData> engineData =
+        prepareEngineData(options, sample, numPoints, problem.pointSize);
+    std::unique_ptr<LloydStep> step =
+        createLloydStep(options, engineData.get(), numPoints,
+                        problem.numClusters, problem.pointSize);
+
+    CentroidMatrix centroids = initialCentroids;
+    std::vector<int> clusters(numPoints, -1);
+    std::vector<int> pointCounts(problem.numClusters);
+
+    Timer timer;
+    bool changed = true;
+    for (int s = 0; changed && s < calibrationSteps; s++) {
+        double distSquaredSum;
+        centroids.updateBlocked();
+        for (size_t chunk = 0; chunk < step->numChunks(); chunk++)
+            step->processChunk(chunk, kernels, sample, centroids, clusters.data());
+        changed = step->finish(centroids, pointCounts, distSquaredSum);
+    }
+    timer.stop();
+    return timer.durationNanoSeconds() / 1e9;
+}
+
+} // namespace
+
+int availableCores(int processesPerNode) {
+#ifdef _OPENMP
+    int cores = omp_get_num_procs();
+    const int hardware = std::thread::hardware_concurrency();
+    if (hardware > 0)
+        cores = std::min(cores, hardware / std::max(processesPerNode, 1));
+    return std::max(cores, 1);
+#else
+    return 1;
+#endif
+}
+
+TuningFixed fixedTuningChoice(const TuningProblem &problem,
+                              const KMeansOptions &options, int numThreads) {
+    TuningFixed fixed;
+    fixed.engine = options.engineGiven;
+    fixed.given.engine = options.engine;
+    switch (problem.backend) {
+    case KMeansBackend::OpenMP:
+        fixed.numThreads = options.threadsGiven;
+        fixed.given.numThreads = std::max(numThreads, 1);
+        fixed.splitPoints = options.batchGiven;
+        fixed.given.splitPoints = options.repetitionBatchSize > 1;
+        fixed.repetitionBatchSize = options.repetitionBatchSize;
+        break;
+    case KMeansBackend::MPI:
+        fixed.numThreads = options.threadsPerRankGiven;
+        fixed.given.numThreads = std::max(options.threadsPerRank, 1);
+        fixed.splitPoints = options.mpiModeGiven;
+        // as usesDataParallelMPI decides
+        fixed.given.splitPoints =
+            options.mpiMode == MPIMode::Data ||
+            (options.mpiMode == MPIMode::Auto &&
+             problem.repetitions < problem.numProcesses);
+        break;
+    default:
+        break;
+    }
+    return fixed;
+}
+
+bool lookupTuningChoice(const std::string &cacheFileName,
+                        const TuningProblem &problem, TuningChoice &choice) {
+    std::ifstream file(cacheFileName);
+    const std::string key = problemKey(problem) + ",";
+    bool found = false;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, key.size(), key) != 0)
+            continue;
+
+        // engine,threads,axis
+        std::istringstream fields(line.substr(key.size()));
+        std::string engine, threads, axis;
+        std::getline(fields, engine, ',');
+        std::getline(fields, threads, ',');
+        std::getline(fields, axis, ',');
+        TuningChoice cached;
+        if (!parseEngineName(engine, cached.engine) ||
+            (axis != "points" && axis != "repetitions"))
+            continue;
+        cached.numThreads = std::max(std::atoi(threads.c_str()), 1);
+        cached.splitPoints = axis == "points";
+        choice = cached;
+        found = true;
+    }
+    return found;
+}
+
+void storeTuningChoice(const std::string &cacheFileName,
+                       const TuningProblem &problem,
+                       const TuningChoice &choice) {
+    const bool exists = std::ifstream(cacheFileName).good();
+    std::ofstream file(cacheFileName, std::ios::app);
+    if (!exists)
+        file << "# numpoints,pointsize,clusters,repetitions,backend,"
+                "processes,cores,engine,threads,axis"
+             << std::endl;
+    file << problemKey(problem) << "," << engineName(choice.engine) << ","
+         << choice.numThreads << ","
+         << (choice.splitPoints ? "points" : "repetitions") << std::endl;
+    if (!file)
+        std::cerr << "WARNING: Unable to write auto-tuning cache "
+                  << cacheFileName << std::endl;
+}
+
+TuningChoice calibrate(const TuningProblem &problem, const double *allData,
+                       const KMeansKernels &kernels,
+                       const TuningFixed &fixed) {
+    const size_t n = problem.numPoints;
+    const size_t d = problem.pointSize;
+    const size_t k = problem.numClusters;
+
+    // an evenly spread sample, the dataset itself if it is small
+    const size_t numSample = std::min(
+        n, std::max(samplePoints, samplePointsPerCluster * k));
+    std::vector<double> sampleData;
+    const double *sample = allData;
+    if (numSample < n) {
+        sampleData.resize(numSample * d);
+        for (size_t i = 0; i < numSample; i++)
+            std::copy_n(allData + (i * n / numSample) * d, d,
+                        sampleData.begin() + i * d);
+        sample = sampleData.data();
+    }
+
+    Rng rng(1);
+    CentroidMatrix initialCentroids(k, d);
+    chooseCentroidsAtRandomFromDataset(rng, 0, numSample, d, sample,
+                                       initialCentroids);
+
+    TuningChoice choice;
+    double lloydSeconds = 0, bestSeconds = 0;
+    if (fixed.engine) {
+        // only its time is needed, for the threads
+        choice.engine = fixed.given.engine;
+        bestSeconds = timeEngine(choice.engine, sample, numSample, problem,
+                                 kernels, initialCentroids);
+    } else {
+        for (KMeansEngine engine : candidates) {
+            if (engine == KMeansEngine::Elkan &&
+                elkanBytes(problem, fixed) > maxElkanBytes)
+                continue;
+            const double seconds = timeEngine(engine, sample, numSample,
+                                              problem, kernels,
+                                              initialCentroids);
+            if (engine == KMeansEngine::Lloyd) {
+                lloydSeconds = bestSeconds = seconds;
+            } else if (seconds < bestSeconds &&
+                       seconds < minGain * lloydSeconds) {
+                choice.engine = engine;
+                bestSeconds = seconds;
+            }
+        }
+    }
+
+    // every thread should get enough of the work of the run
+    const double runSeconds = bestSeconds / calibrationSteps * n / numSample *
+                              assumedSteps * problem.repetitions /
+                              problem.numProcesses;
+    if (fixed.numThreads)
+        choice.numThreads = fixed.given.numThreads;
+    else if (problem.backend != KMeansBackend::Serial)
+        choice.numThreads = std::max(
+            1, std::min(problem.coresPerProcess,
+                        (int)(runSeconds / minSecondsPerThread)));
+
+    // with fewer repetitions than workers, a repetition each leaves some idle
+    const int workers = problem.backend == KMeansBackend::MPI
+                            ? problem.numProcesses
+                            : choice.numThreads;
+    choice.splitPoints = fixed.splitPoints ? fixed.given.splitPoints
+                                           : problem.repetitions < workers;
+    return choice;
+}
+
+void applyTuningChoice(const TuningProblem &problem,
+                       const TuningChoice &choice, const TuningFixed &fixed,
+                       KMeansOptions &options, int &numThreads) {
+    if (!fixed.engine)
+        options.engine = choice.engine;
+    switch (problem.backend) {
+    case KMeansBackend::OpenMP:
+        if (!fixed.numThreads)
+            numThreads = choice.numThreads;
+        if (!fixed.splitPoints)
+            options.repetitionBatchSize =
+                choice.splitPoints ? problem.repetitions : 0;
+        break;
+    case KMeansBackend::MPI:
+        if (!options.threadsGiven)
+            numThreads = problem.numProcesses;
+        if (!fixed.numThreads)
+            options.threadsPerRank = choice.numThreads;
+        if (!fixed.splitPoints)
+            options.mpiMode =
+                choice.splitPoints ? MPIMode::Data : MPIMode::Repetitions;
+        break;
+    default:
+        if (!options.threadsGiven)
+            numThreads = 1;
+    }
+}
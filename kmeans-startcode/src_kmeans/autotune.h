@@ -0,0 +1,72 @@
+#pragma once
+
+#include "helper_functions.h"
+#include "kmeans.h"
+
+// The shape of a run, as far as the auto-tuner is concerned. Runs of the same
+// shape on the same machine get the same choice.
+struct TuningProblem {
+    size_t numPoints;
+    size_t pointSize;
+    int numClusters;
+    int repetitions;
+    KMeansBackend backend; // Serial, OpenMP or MPI
+    int numProcesses;      // 1 unless MPI
+    int coresPerProcess;
+};
+
+// What the auto-tuner picks. All choices give the same results: the engines
+// that are bit-identical to Lloyd's, and the axes of the backends that are.
+struct TuningChoice {
+    KMeansEngine engine = KMeansEngine::Lloyd;
+    int numThreads = 1; // per process
+    // run every repetition on all threads (or processes) together, instead
+    // of a repetition each
+    bool splitPoints = false;
+};
+
+// The parts of the choice the command line fixed (see KMeansOptions), with
+// their values in 'given'. The auto-tuner only chooses the others.
+struct TuningFixed {
+    bool engine = false;
+    bool numThreads = false;
+    bool splitPoints = false;
+    TuningChoice given;
+    int repetitionBatchSize = 0; // OpenMP, if splitPoints is fixed
+
+    bool any() const { return engine || numThreads || splitPoints; }
+};
+
+// Which parts of the choice the options and 'numThreads' fix, for the
+// backend of the problem
+TuningFixed fixedTuningChoice(const TuningProblem &problem,
+                              const KMeansOptions &options, int numThreads);
+
+// The cores this process can use for threads: those it is bound to, or its
+// share of the node with 'processesPerNode' processes on it. 1 without
+// OpenMP.
+int availableCores(int processesPerNode = 1);
+
+// Looks up the choice for the problem in the cache file, false if it has none
+bool lookupTuningChoice(const std::string &cacheFileName,
+                        const TuningProblem &problem, TuningChoice &choice);
+
+// Adds the choice for the problem to the cache file; a later one of the same
+// problem replaces it
+void storeTuningChoice(const std::string &cacheFileName,
+                       const TuningProblem &problem,
+                       const TuningChoice &choice);
+
+// Times a few steps of every engine on a sample of the dataset, on one
+// thread, and picks the fastest. The number of threads and the axis follow
+// from the estimated time of the whole run and the number of repetitions.
+// The fixed parts are taken as given.
+TuningChoice calibrate(const TuningProblem &problem, const double *allData,
+                       const KMeansKernels &kernels,
+                       const TuningFixed &fixed = TuningFixed());
+
+// Sets the engine, the threads and the axis of the backend of the problem,
+// except for the fixed ones
+void applyTuningChoice(const TuningProblem &problem,
+                       const TuningChoice &choice, const TuningFixed &fixed,
+                       KMeansOptions &options, int &numThreads);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "AlignedAllocator.h"
+#include <cstdlib>
+#include <limits>
+
+// The k centroids of a clustering, stored in a single cache-line aligned
+// allocation instead of one vector per centroid.
+//
+// The row-major (AoS) values are the master copy: centroid i is the row
+// starting at (*this)[i]. The SIMD distance kernels read a second, blocked
+// copy (AoSoA): for every block of 'blockSize' centroids, the values of
+// dimension 0 of those centroids come first, then those of dimension 1, etc.
+// Unused entries of the last block are NaN, which never compare as closer.
+// updateBlocked() refreshes this copy after the rows were changed.
+class CentroidMatrix {
+  public:
+    static const size_t blockSize = 8; // one AVX-512 vector of doubles
+
+    CentroidMatrix(size_t numCentroids = 0, size_t pointSize = 0) {
+        resize(numCentroids, pointSize);
+    }
+
+    void resize(size_t numCentroids, size_t pointSize) {
+        m_numCentroids = numCentroids;
+        m_pointSize = pointSize;
+        m_numBlocks = (numCentroids + blockSize - 1) / blockSize;
+        m_rows.assign(numCentroids * pointSize, 0);
+        m_blocked.assign(m_numBlocks * blockSize * pointSize,
+                         std::numeric_limits<double>::quiet_NaN());
+    }
+
+    size_t numCentroids() const { return m_numCentroids; }
+    size_t pointSize() const { return m_pointSize; }
+
+    double *operator[](size_t i) { return m_rows.data() + i * m_pointSize; }
+    const double *operator[](size_t i) const {
+        return m_rows.data() + i * m_pointSize;
+    }
+    double *data() { return m_rows.data(); }
+    const double *data() const { return m_rows.data(); }
+
+    void updateBlocked() {
+        for (size_t i = 0; i < m_numCentroids; i++)
+            for (size_t dim = 0; dim < m_pointSize; dim++)
+                m_blocked[blockedIndex(i, dim)] = m_rows[i * m_pointSize + dim];
+    }
+
+    // Blocked copy: dimension 'dim' of centroid i is at blockedIndex(i, dim)
+    const double *blocked() const { return m_blocked.data(); }
+    size_t blockedIndex(size_t i, size_t dim) const {
+        return (i / blockSize * m_pointSize + dim) * blockSize + i % blockSize;
+    }
+
+  private:
+    size_t m_numCentroids = 0;
+    size_t m_pointSize = 0;
+    size_t m_numBlocks = 0;
+    AlignedVector<double> m_rows;
+    AlignedVector<double> m_blocked;
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
+// Bounds on exact Euclidean distances, derived from squared distances as
+// computed by squaredDistance, for the engines that skip distance
+// calculations with the triangle inequality.
+//
+// A computed squared distance is within a relative (pointSize + 3) * eps / 2
+// of the exact one. Every bound is widened by a larger relative tolerance, so
+// that when a lower bound of one centroid exceeds an upper bound of another,
+// the computed squared distances also differ (and in the same direction).
+// Skipping a centroid on such a test therefore never changes which centroid
+// the full scan would pick, ties included.
+class DistanceBounds {
+  public:
+    explicit DistanceBounds(size_t pointSize)
+        : m_tolerance{(pointSize + 8) * DBL_EPSILON} {}
+
+    double lower(double squaredDist) const {
+        return std::sqrt(squaredDist) * (1 - m_tolerance);
+    }
+    double upper(double squaredDist) const {
+        return std::sqrt(squaredDist) * (1 + m_tolerance);
+    }
+
+    // lower bound after the centroid moved over at most 'drift'
+    double shrink(double lowerBound, double drift) const {
+        return std::max(0.0, (lowerBound - drift) * (1 - m_tolerance));
+    }
+    // upper bound after the centroid moved over at most 'drift'
+    double grow(double upperBound, double drift) const {
+        return (upperBound + drift) * (1 + m_tolerance);
+    }
+
+  private:
+    double m_tolerance;
+};
@@ -0,0 +1,319 @@
+#include "distance_kernels.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <utility>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define KMEANS_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+// All kernels accumulate (x - c)^2 over the dimensions in order, per
+// centroid, so every kernel computes exactly the same distances as the
+// scalar reference. Note that there is no fused multiply-add: contracting
+// would change the rounding.
+//
+// The centroids are read from the blocked (AoSoA) copy of the
+// CentroidMatrix, so every vector load is one aligned load of consecutive
+// centroids.
+//
+// The kernels are templates over the point size D, so that for the common
+// small dimensions the loop over the dimensions is fully unrolled and the
+// broadcast point stays in registers. D == 0 is the generic version.
+
+namespace {
+
+const size_t blockSize = CentroidMatrix::blockSize;
+
+const double initialBestDist = std::numeric_limits<int>::max();
+
+template <size_t D>
+void closestCentroidScalar(const double *point, size_t pointSize,
+                           const CentroidMatrix &centroids,
+                           int &newCluster, double &bestDist) {
+    const size_t dims = D > 0 ? D : pointSize;
+    newCluster = -1;
+    bestDist = initialBestDist; // can only get better
+
+    for (size_t i = 0; i < centroids.numCentroids(); i++) {
+        const double *c = centroids.blocked() + centroids.blockedIndex(i, 0);
+        double dist = 0;
+        for (size_t dim = 0; dim < dims; dim++) {
+            const double diff = point[dim] - c[dim * blockSize];
+            dist += diff * diff;
+        }
+        if (dist < bestDist) {
+            newCluster = i;
+            bestDist = dist;
+        }
+    }
+}
+
+#ifdef KMEANS_X86_KERNELS
+
+// Every lane keeps the first closest centroid of its own subset of
+// centroids; the overall result is the closest over all lanes, taking the
+// lowest index on ties.
+inline void reduceLanes(const double *best, const double *bestIndex,
+                        size_t numLanes, int &newCluster, double &bestDist) {
+    newCluster = -1;
+    bestDist = initialBestDist;
+    for (size_t l = 0; l < numLanes; l++) {
+        if (bestIndex[l] < 0)
+            continue;
+        if (best[l] < bestDist ||
+            (best[l] == bestDist && (int)bestIndex[l] < newCluster)) {
+            bestDist = best[l];
+            newCluster = (int)bestIndex[l];
+        }
+    }
+}
+
+template <size_t D>
+__attribute__((target("sse2")))
+void closestCentroidSSE2(const double *point, size_t pointSize,
+                         const CentroidMatrix &centroids,
+                         int &newCluster, double &bestDist) {
+    const size_t dims = D > 0 ? D : pointSize;
+    __m128d best = _mm_set1_pd(initialBestDist);
+    __m128d bestIndex = _mm_set1_pd(-1);
+    __m128d index = _mm_set_pd(1, 0);
+    const __m128d step = _mm_set1_pd(2);
+
+    for (size_t i = 0; i < centroids.numCentroids(); i += 2) {
+        const double *c = centroids.blocked() + centroids.blockedIndex(i, 0);
+        __m128d dist = _mm_setzero_pd();
+        for (size_t dim = 0; dim < dims; dim++) {
+            const __m128d diff = _mm_sub_pd(
+                _mm_set1_pd(point[dim]),
+                _mm_load_pd(c + dim * blockSize));
+            dist = _mm_add_pd(dist, _mm_mul_pd(diff, diff));
+        }
+        const __m128d closer = _mm_cmplt_pd(dist, best);
+        best = _mm_or_pd(_mm_and_pd(closer, dist), _mm_andnot_pd(closer, best));
+        bestIndex = _mm_or_pd(_mm_and_pd(closer, index),
+                              _mm_andnot_pd(closer, bestIndex));
+        index = _mm_add_pd(index, step);
+    }
+
+    double b[2], bi[2];
+    _mm_storeu_pd(b, best);
+    _mm_storeu_pd(bi, bestIndex);
+    reduceLanes(b, bi, 2, newCluster, bestDist);
+}
+
+template <size_t D>
+__attribute__((target("avx2")))
+void closestCentroidAVX2(const double *point, size_t pointSize,
+                         const CentroidMatrix &centroids,
+                         int &newCluster, double &bestDist) {
+    const size_t dims = D > 0 ? D : pointSize;
+    __m256d best = _mm256_set1_pd(initialBestDist);
+    __m256d bestIndex = _mm256_set1_pd(-1);
+    __m256d index = _mm256_set_pd(3, 2, 1, 0);
+    const __m256d step = _mm256_set1_pd(4);
+
+    for (size_t i = 0; i < centroids.numCentroids(); i += 4) {
+        const double *c = centroids.blocked() + centroids.blockedIndex(i, 0);
+        __m256d dist = _mm256_setzero_pd();
+        for (size_t dim = 0; dim < dims; dim++) {
+            const __m256d diff = _mm256_sub_pd(
+                _mm256_set1_pd(point[dim]),
+                _mm256_load_pd(c + dim * blockSize));
+            dist = _mm256_add_pd(dist, _mm256_mul_pd(diff, diff));
+        }
+        const __m256d closer = _mm256_cmp_pd(dist, best, _CMP_LT_OQ);
+        best = _mm256_blendv_pd(best, dist, closer);
+        bestIndex = _mm256_blendv_pd(bestIndex, index, closer);
+        index = _mm256_add_pd(index, step);
+    }
+
+    double b[4], bi[4];
+    _mm256_storeu_pd(b, best);
+    _mm256_storeu_pd(bi, bestIndex);
+    reduceLanes(b, bi, 4, newCluster, bestDist);
+}
+
+template <size_t D>
+__attribute__((target("avx512f")))
+void closestCentroidAVX512(const double *point, size_t pointSize,
+                           const CentroidMatrix &centroids,
+                           int &newCluster, double &bestDist) {
+    const size_t dims = D > 0 ? D : pointSize;
+    __m512d best = _mm512_set1_pd(initialBestDist);
+    __m512d bestIndex = _mm512_set1_pd(-1);
+    __m512d index = _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0);
+    const __m512d step = _mm512_set1_pd(8);
+
+    for (size_t i = 0; i < centroids.numCentroids(); i += 8) {
+        const double *c = centroids.blocked() + centroids.blockedIndex(i, 0);
+        __m512d dist = _mm512_setzero_pd();
+        for (size_t dim = 0; dim < dims; dim++) {
+            const __m512d diff = _mm512_sub_pd(
+                _mm512_set1_pd(point[dim]),
+                _mm512_load_pd(c + dim * blockSize));
+            dist = _mm512_add_pd(dist, _mm512_mul_pd(diff, diff));
+        }
+        const __mmask8 closer = _mm512_cmp_pd_mask(dist, best, _CMP_LT_OQ);
+        best = _mm512_mask_blend_pd(closer, best, dist);
+        bestIndex = _mm512_mask_blend_pd(closer, bestIndex, index);
+        index = _mm512_add_pd(index, step);
+    }
+
+    double b[8], bi[8];
+    _mm512_storeu_pd(b, best);
+    _mm512_storeu_pd(bi, bestIndex);
+    reduceLanes(b, bi, 8, newCluster, bestDist);
+}
+
+// The dot product tiles keep dotTilePoints x blockSize sums in registers
+// (half of them at a time for AVX2, which has only 16 registers), enough
+// independent sums to hide the latency of the additions, and load every value
+// of the centroid block once per tile.
+
+__attribute__((target("avx2")))
+void dotProductTileAVX2(const double *const *points, size_t pointSize,
+                        const double *block, double *out) {
+    const size_t half = dotTilePoints / 2;
+    for (size_t first = 0; first < dotTilePoints; first += half) {
+        __m256d sum[half][2];
+        for (size_t p = 0; p < half; p++)
+            sum[p][0] = sum[p][1] = _mm256_setzero_pd();
+
+        for (size_t dim = 0; dim < pointSize; dim++) {
+            const __m256d c0 = _mm256_load_pd(block + dim * blockSize);
+            const __m256d c1 = _mm256_load_pd(block + dim * blockSize + 4);
+            for (size_t p = 0; p < half; p++) {
+                const __m256d x = _mm256_broadcast_sd(points[first + p] + dim);
+                sum[p][0] = _mm256_add_pd(sum[p][0], _mm256_mul_pd(x, c0));
+                sum[p][1] = _mm256_add_pd(sum[p][1], _mm256_mul_pd(x, c1));
+            }
+        }
+
+        for (size_t p = 0; p < half; p++) {
+            _mm256_storeu_pd(out + (first + p) * blockSize, sum[p][0]);
+            _mm256_storeu_pd(out + (first + p) * blockSize + 4, sum[p][1]);
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+void dotProductTileAVX512(const double *const *points, size_t pointSize,
+                          const double *block, double *out) {
+    __m512d sum[dotTilePoints];
+    for (size_t p = 0; p < dotTilePoints; p++)
+        sum[p] = _mm512_setzero_pd();
+
+    for (size_t dim = 0; dim < pointSize; dim++) {
+        const __m512d c = _mm512_load_pd(block + dim * blockSize);
+        for (size_t p = 0; p < dotTilePoints; p++)
+            sum[p] = _mm512_fmadd_pd(_mm512_set1_pd(points[p][dim]), c,
+                                     sum[p]);
+    }
+
+    for (size_t p = 0; p < dotTilePoints; p++)
+        _mm512_storeu_pd(out + p * blockSize, sum[p]);
+}
+
+#endif // KMEANS_X86_KERNELS
+
+void dotProductTileScalar(const double *const *points, size_t pointSize,
+                          const double *block, double *out) {
+    std::fill(out, out + dotTilePoints * blockSize, 0.0);
+    for (size_t dim = 0; dim < pointSize; dim++) {
+        const double *c = block + dim * blockSize;
+        for (size_t p = 0; p < dotTilePoints; p++) {
+            const double x = points[p][dim];
+            for (size_t l = 0; l < blockSize; l++)
+                out[p * blockSize + l] += x * c[l];
+        }
+    }
+}
+
+SimdLevel cpuSimdLevel() {
+#ifdef KMEANS_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return SimdLevel::AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SimdLevel::SSE2;
+#endif
+    return SimdLevel::Scalar;
+}
+
+template <size_t D> ClosestCentroidKernel kernelForLevel(SimdLevel level) {
+#ifdef KMEANS_X86_KERNELS
+    switch (level) {
+    case SimdLevel::SSE2:
+        return closestCentroidSSE2<D>;
+    case SimdLevel::AVX2:
+        return closestCentroidAVX2<D>;
+    case SimdLevel::AVX512:
+        return closestCentroidAVX512<D>;
+    default:
+        break;
+    }
+#endif
+    return closestCentroidScalar<D>;
+}
+
+template <size_t... D>
+ClosestCentroidKernel selectForPointSize(SimdLevel level, size_t pointSize,
+                                         std::index_sequence<D...>) {
+    const ClosestCentroidKernel kernels[] = {kernelForLevel<D>(level)...};
+    return pointSize < sizeof...(D) ? kernels[pointSize] : kernels[0];
+}
+
+} // namespace
+
+SimdLevel detectSimdLevel() {
+    SimdLevel level = cpuSimdLevel();
+
+    const char *requested = getenv("KMEANS_SIMD");
+    if (requested) {
+        for (SimdLevel l : {SimdLevel::Scalar, SimdLevel::SSE2,
+                            SimdLevel::AVX2, SimdLevel::AVX512}) {
+            if (strcmp(requested, simdLevelName(l)) == 0 && l < level)
+                level = l;
+        }
+    }
+    return level;
+}
+
+const char *simdLevelName(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::SSE2:
+        return "sse2";
+    case SimdLevel::AVX2:
+        return "avx2";
+    case SimdLevel::AVX512:
+        return "avx512";
+    default:
+        return "scalar";
+    }
+}
+
+ClosestCentroidKernel getClosestCentroidKernel(SimdLevel level,
+                                               size_t pointSize) {
+    return selectForPointSize(
+        level, pointSize,
+        std::make_index_sequence<maxSpecializedPointSize + 1>());
+}
+
+DotProductTileKernel getDotProductTileKernel(SimdLevel level) {
+#ifdef KMEANS_X86_KERNELS
+    switch (level) {
+    case SimdLevel::AVX2:
+        return dotProductTileAVX2;
+    case SimdLevel::AVX512:
+        return dotProductTileAVX512;
+    default:
+        break;
+    }
+#endif
+    return dotProductTileScalar;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "centroid_matrix.h"
+#include <cstdlib>
+
+// Finds the centroid closest to 'point', with the same result as the scalar
+// reference: the first centroid with the smallest squared distance, or -1 if
+// none is closer than std::numeric_limits<int>::max(). The kernels read the
+// blocked copy of the centroids, which must be up to date.
+typedef void (*ClosestCentroidKernel)(const double *point, size_t pointSize,
+                                      const CentroidMatrix &centroids,
+                                      int &newCluster, double &bestDist);
+
+// Squared Euclidean distance, summed in dimension order like the kernels do,
+// so it is bit-identical to the distances they compare
+inline double squaredDistance(const double *a, const double *b,
+                              size_t pointSize) {
+    double dist = 0;
+    for (size_t dim = 0; dim < pointSize; dim++) {
+        const double diff = a[dim] - b[dim];
+        dist += diff * diff;
+    }
+    return dist;
+}
+
+enum class SimdLevel { Scalar, SSE2, AVX2, AVX512 };
+
+// The best level the CPU supports; the KMEANS_SIMD environment variable
+// (scalar, sse2, avx2 or avx512) can be used to select a lower one.
+SimdLevel detectSimdLevel();
+const char *simdLevelName(SimdLevel level);
+
+// Largest point size with a kernel specialised at compile time, larger point
+// sizes use a generic kernel
+const size_t maxSpecializedPointSize = 16;
+
+ClosestCentroidKernel getClosestCentroidKernel(SimdLevel level,
+                                               size_t pointSize);
+
+// Number of points handled at once by a DotProductTileKernel
+const size_t dotTilePoints = 8;
+
+// Dot products of dotTilePoints points with the CentroidMatrix::blockSize
+// centroids of one block of the blocked copy, starting at 'block':
+// out[p * blockSize + l] is the product of points[p] with centroid l of the
+// block. Unlike the closest centroid kernels, these may change the order of
+// the operations and use fused multiply-adds, so the results are only exact
+// up to rounding.
+typedef void (*DotProductTileKernel)(const double *const *points,
+                                     size_t pointSize, const double *block,
+                                     double *out);
+
+DotProductTileKernel getDotProductTileKernel(SimdLevel level);
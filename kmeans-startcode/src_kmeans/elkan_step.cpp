@@ -0,0 +1,130 @@
+#include "elkan_step.h"
+#include <limits>
+
+ElkanStep::ElkanStep(size_t numPoints, size_t numClusters, size_t pointSize,
+                     int incrementalUpdateInterval)
+    : LloydStep(numPoints, numClusters, pointSize, incrementalUpdateInterval),
+      m_bounds{pointSize}, m_haveBounds{false},
+      m_lower(numPoints * numClusters), m_drift(numClusters),
+      m_halfCentroidDist(numClusters * numClusters),
+      m_halfClosestDist(numClusters),
+      m_previousCentroids(numClusters * pointSize) {}
+
+void ElkanStep::restart() {
+    LloydStep::restart();
+    m_haveBounds = false;
+}
+
+void ElkanStep::processChunk(size_t chunk, const KMeansKernels &kernels,
+                             const double *allData,
+                             const CentroidMatrix &centroids,
+                             int *clusters) {
+    size_t begin, end;
+    double *sums;
+    int *counts;
+    startChunk(chunk, begin, end, sums, counts);
+
+    const size_t k = m_numClusters;
+    const size_t d = m_pointSize;
+    const bool incremental = isIncrementalStep();
+    double distSquaredSum = 0;
+    bool changed = false;
+    size_t distanceCalculations = 0;
+
+    for (size_t pointIndex = begin; pointIndex < end; pointIndex++) {
+        const double *p = allData + pointIndex * d;
+        double *lower = m_lower.data() + pointIndex * k;
+        const int oldCluster = clusters[pointIndex];
+        int newCluster = -1;
+        double bestDist = std::numeric_limits<double>::infinity();
+
+        if (!m_haveBounds) {
+            // first step: compute all distances
+            distanceCalculations += k;
+            for (size_t i = 0; i < k; i++) {
+                const double dist = squaredDistance(p, centroids[i], d);
+                lower[i] = m_bounds.lower(dist);
+                if (dist < bestDist) {
+                    newCluster = i;
+                    bestDist = dist;
+                }
+            }
+        } else {
+            for (size_t i = 0; i < k; i++)
+                lower[i] = m_bounds.shrink(lower[i], m_drift[i]);
+
+            newCluster = oldCluster;
+            bestDist = squaredDistance(p, centroids[newCluster], d);
+            distanceCalculations++;
+            lower[newCluster] = m_bounds.lower(bestDist);
+            double upper = m_bounds.upper(bestDist);
+
+            // no other centroid can be closer if the point is within half
+            // the distance to the closest other centroid
+            if (m_halfClosestDist[oldCluster] <= upper) {
+                for (size_t i = 0; i < k; i++) {
+                    if ((int)i == newCluster || lower[i] > upper ||
+                        m_halfCentroidDist[newCluster * k + i] > upper)
+                        continue;
+
+                    const double dist = squaredDistance(p, centroids[i], d);
+                    distanceCalculations++;
+                    lower[i] = m_bounds.lower(dist);
+                    if (dist < bestDist ||
+                        (dist == bestDist && (int)i < newCluster)) {
+                        newCluster = i;
+                        bestDist = dist;
+                        upper = m_bounds.upper(dist);
+                    }
+                }
+            }
+        }
+
+        distSquaredSum += bestDist;
+
+        if (newCluster != oldCluster) {
+            clusters[pointIndex] = newCluster;
+            changed = true;
+        }
+
+        accumulatePoint(p, oldCluster, newCluster, incremental, sums, counts);
+    }
+
+    endChunk(chunk, distSquaredSum, changed, distanceCalculations);
+}
+
+bool ElkanStep::finish(CentroidMatrix &centroids,
+                       std::vector<int> &pointCounts, double &distSquaredSum) {
+    std::copy(centroids.data(), centroids.data() + m_previousCentroids.size(),
+              m_previousCentroids.begin());
+
+    if (!LloydStep::finish(centroids, pointCounts, distSquaredSum))
+        return false;
+
+    const size_t k = m_numClusters;
+    const size_t d = m_pointSize;
+    for (size_t i = 0; i < k; i++)
+        m_drift[i] = m_bounds.upper(squaredDistance(
+            m_previousCentroids.data() + i * d, centroids[i], d));
+
+    for (size_t i = 0; i < k; i++) {
+        m_halfCentroidDist[i * k + i] = 0;
+        for (size_t j = i + 1; j < k; j++) {
+            const double half =
+                m_bounds.lower(squaredDistance(centroids[i], centroids[j], d)) /
+                2;
+            m_halfCentroidDist[i * k + j] = half;
+            m_halfCentroidDist[j * k + i] = half;
+        }
+    }
+    for (size_t i = 0; i < k; i++) {
+        double closest = std::numeric_limits<double>::infinity();
+        for (size_t j = 0; j < k; j++)
+            if (j != i)
+                closest = std::min(closest, m_halfCentroidDist[i * k + j]);
+        m_halfClosestDist[i] = closest;
+    }
+
+    m_haveBounds = true;
+    return true;
+}
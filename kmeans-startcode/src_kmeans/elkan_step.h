@@ -0,0 +1,41 @@
+#pragma once
+
+#include "distance_bounds.h"
+#include "lloyd_step.h"
+
+// Elkan's accelerated Lloyd step. Every point keeps an upper bound on the
+// distance to its centroid and a lower bound on the distance to every other
+// centroid; together with the distances between the centroids these skip
+// most distance calculations once the centroids only move a little.
+//
+// The distance to the assigned centroid is always recomputed, since it is
+// needed for the distance sum, and every centroid that is not skipped is
+// compared on its computed squared distance with ties going to the lowest
+// index. The clusters, centroids and step counts are the same as those of
+// LloydStep. The lower bounds take numPoints x numClusters doubles.
+class ElkanStep : public LloydStep {
+  public:
+    ElkanStep(size_t numPoints, size_t numClusters, size_t pointSize,
+              int incrementalUpdateInterval = 0);
+
+    void processChunk(size_t chunk, const KMeansKernels &kernels,
+                      const double *allData, const CentroidMatrix &centroids,
+                      int *clusters) override;
+
+    bool finish(CentroidMatrix &centroids, std::vector<int> &pointCounts,
+                double &distSquaredSum) override;
+    void restart() override;
+
+  private:
+    DistanceBounds m_bounds;
+    bool m_haveBounds;
+
+    std::vector<double> m_lower; // numPoints x numClusters
+    // how far each centroid moved in the last step
+    std::vector<double> m_drift;
+    // half the distance between every two centroids, and to the closest other
+    // centroid
+    std::vector<double> m_halfCentroidDist; // numClusters x numClusters
+    std::vector<double> m_halfClosestDist;
+    std::vector<double> m_previousCentroids;
+};
@@ -0,0 +1,158 @@
+#include "gemm_step.h"
+#include <cfloat>
+#include <cmath>
+#include <limits>
+
+namespace {
+
+// Points per cache tile; all centroid blocks are applied to the tile before
+// moving on to the next one
+const size_t tilePoints = 64;
+
+const size_t blockSize = CentroidMatrix::blockSize;
+
+} // namespace
+
+PointNorms::PointNorms(const double *allData, size_t numPoints,
+                       size_t pointSize, size_t firstPoint, size_t lastPoint)
+    : m_norms(numPoints) {
+    const std::vector<double> origin(pointSize, 0);
+    for (size_t i = firstPoint; i < lastPoint; i++)
+        m_norms[i] = std::sqrt(
+            squaredDistance(allData + i * pointSize, origin.data(), pointSize));
+}
+
+GemmStep::GemmStep(const PointNorms &pointNorms, size_t numPoints,
+                   size_t numClusters, size_t pointSize,
+                   int incrementalUpdateInterval)
+    : LloydStep(numPoints, numClusters, pointSize, incrementalUpdateInterval),
+      m_pointNorms{pointNorms},
+      m_dotProductTile{getDotProductTileKernel(detectSimdLevel())},
+      m_tolerance{4 * (pointSize + 8) * DBL_EPSILON},
+      m_haveCentroidNorms{new std::once_flag},
+      m_centroidSquaredNorms(numClusters), m_maxCentroidNorm{0} {}
+
+void GemmStep::restart() {
+    LloydStep::restart();
+    m_haveCentroidNorms.reset(new std::once_flag);
+}
+
+void GemmStep::computeCentroidNorms(const CentroidMatrix &centroids) {
+    const std::vector<double> origin(m_pointSize, 0);
+    m_maxCentroidNorm = 0;
+    for (size_t i = 0; i < m_numClusters; i++) {
+        m_centroidSquaredNorms[i] =
+            squaredDistance(centroids[i], origin.data(), m_pointSize);
+        m_maxCentroidNorm = std::max(m_maxCentroidNorm,
+                                     std::sqrt(m_centroidSquaredNorms[i]));
+    }
+}
+
+void GemmStep::processChunk(size_t chunk, const KMeansKernels &kernels,
+                            const double *allData,
+                            const CentroidMatrix &centroids,
+                            int *clusters) {
+    // later steps get the norms from finish
+    std::call_once(*m_haveCentroidNorms,
+                   [&] { computeCentroidNorms(centroids); });
+
+    size_t begin, end;
+    double *sums;
+    int *counts;
+    startChunk(chunk, begin, end, sums, counts);
+
+    const size_t k = m_numClusters;
+    const size_t d = m_pointSize;
+    const size_t numBlocks = (k + blockSize - 1) / blockSize;
+    const bool incremental = isIncrementalStep();
+    double distSquaredSum = 0;
+    bool changed = false;
+
+    // the expanded distances of the tile, without the |x|^2 that is the same
+    // for all centroids of a point, and the smallest per point
+    std::vector<double> dist(tilePoints * k);
+    double minDist[tilePoints];
+    double dots[dotTilePoints * blockSize];
+
+    for (size_t tile = begin; tile < end; tile += tilePoints) {
+        const size_t tileEnd = std::min(tile + tilePoints, end);
+        std::fill(minDist, minDist + tilePoints,
+                  std::numeric_limits<double>::infinity());
+
+        for (size_t b = 0; b < numBlocks; b++) {
+            const double *block =
+                centroids.blocked() + centroids.blockedIndex(b * blockSize, 0);
+            const size_t blockBegin = b * blockSize;
+            const size_t blockEnd = std::min(blockBegin + blockSize, k);
+
+            for (size_t first = tile; first < tileEnd; first += dotTilePoints) {
+                // the last group of points is padded with its last point
+                const double *points[dotTilePoints];
+                for (size_t p = 0; p < dotTilePoints; p++)
+                    points[p] =
+                        allData + std::min(first + p, tileEnd - 1) * d;
+                m_dotProductTile(points, d, block, dots);
+
+                const size_t groupEnd =
+                    std::min(first + dotTilePoints, tileEnd);
+                for (size_t point = first; point < groupEnd; point++) {
+                    const double *dot = dots + (point - first) * blockSize;
+                    double *pointDist = dist.data() + (point - tile) * k;
+                    double pointMin = minDist[point - tile];
+                    for (size_t i = blockBegin; i < blockEnd; i++) {
+                        pointDist[i] = m_centroidSquaredNorms[i] -
+                                       2 * dot[i - blockBegin];
+                        pointMin = std::min(pointMin, pointDist[i]);
+                    }
+                    minDist[point - tile] = pointMin;
+                }
+            }
+        }
+
+        // The rounding error of every expanded distance is below
+        // m_tolerance * (|x| + |c|)^2. Only the centroids that can be
+        // within those bounds of the closest one are compared with their
+        // exact distances, in the order of the full scan.
+        for (size_t point = tile; point < tileEnd; point++) {
+            const double *p = allData + point * d;
+            const double *pointDist = dist.data() + (point - tile) * k;
+            const double norms = m_pointNorms.norm(point) + m_maxCentroidNorm;
+            const double limit =
+                minDist[point - tile] + 2 * m_tolerance * norms * norms;
+
+            int newCluster = -1;
+            double bestDist = std::numeric_limits<double>::infinity();
+            for (size_t i = 0; i < k; i++) {
+                if (pointDist[i] > limit)
+                    continue;
+                const double exact = squaredDistance(p, centroids[i], d);
+                if (exact < bestDist) {
+                    newCluster = i;
+                    bestDist = exact;
+                }
+            }
+
+            distSquaredSum += bestDist;
+
+            const int oldCluster = clusters[point];
+            if (newCluster != oldCluster) {
+                clusters[point] = newCluster;
+                changed = true;
+            }
+
+            accumulatePoint(p, oldCluster, newCluster, incremental, sums,
+                            counts);
+        }
+    }
+
+    // all distances are calculated, if only approximately
+    endChunk(chunk, distSquaredSum, changed, (end - begin) * k);
+}
+
+bool GemmStep::finish(CentroidMatrix &centroids, std::vector<int> &pointCounts,
+                      double &distSquaredSum) {
+    if (!LloydStep::finish(centroids, pointCounts, distSquaredSum))
+        return false;
+    computeCentroidNorms(centroids);
+    return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "lloyd_step.h"
+#include <mutex>
+
+// The norms of all points, computed once per run for the error bounds of
+// GemmStep
+class PointNorms : public EngineData {
+  public:
+    // the norms of the points [firstPoint, lastPoint), the others are 0
+    PointNorms(const double *allData, size_t numPoints, size_t pointSize,
+               size_t firstPoint, size_t lastPoint);
+
+    double norm(size_t point) const { return m_norms[point]; }
+
+  private:
+    std::vector<double> m_norms;
+};
+
+// Computes the distances for tiles of points at once, as
+// |x - c|^2 = |x|^2 - 2 x.c + |c|^2, with the dot products done like a
+// matrix product of the points with the (blocked) centroids: a register
+// blocked micro-kernel for dotTilePoints points and one block of centroids,
+// over a tile of points that stays in cache while all centroid blocks are
+// passed. |x|^2 is the same for all centroids, so only |c|^2 - 2 x.c is
+// compared, and the closest centroid per point is tracked while the tile is
+// computed. This pays off for wide points (32 dimensions or more).
+//
+// The expanded distances round differently, so they only select candidates:
+// every centroid whose distance is within the rounding error bound of the
+// smallest one is recomputed with squaredDistance and compared as in the
+// full scan. The clusters, centroids and step counts are the same as those of
+// LloydStep.
+class GemmStep : public LloydStep {
+  public:
+    GemmStep(const PointNorms &pointNorms, size_t numPoints,
+             size_t numClusters, size_t pointSize,
+             int incrementalUpdateInterval = 0);
+
+    void processChunk(size_t chunk, const KMeansKernels &kernels,
+                      const double *allData, const CentroidMatrix &centroids,
+                      int *clusters) override;
+
+    bool finish(CentroidMatrix &centroids, std::vector<int> &pointCounts,
+                double &distSquaredSum) override;
+    void restart() override;
+
+  private:
+    void computeCentroidNorms(const CentroidMatrix &centroids);
+
+    const PointNorms &m_pointNorms;
+    DotProductTileKernel m_dotProductTile;
+    // relative error bound of the expanded distances
+    double m_tolerance;
+
+    std::unique_ptr<std::once_flag> m_haveCentroidNorms; // new per repetition
+    std::vector<double> m_centroidSquaredNorms;
+    double m_maxCentroidNorm;
+};
@@ -0,0 +1,128 @@
+#include "hamerly_step.h"
+#include <limits>
+
+HamerlyStep::HamerlyStep(size_t numPoints, size_t numClusters,
+                         size_t pointSize, int incrementalUpdateInterval)
+    : LloydStep(numPoints, numClusters, pointSize, incrementalUpdateInterval),
+      m_bounds{pointSize}, m_haveBounds{false}, m_lower(numPoints),
+      m_drift(numClusters), m_maxDriftCluster{-1}, m_maxDrift{0},
+      m_secondMaxDrift{0}, m_halfClosestDist(numClusters),
+      m_previousCentroids(numClusters * pointSize) {}
+
+void HamerlyStep::restart() {
+    LloydStep::restart();
+    m_haveBounds = false;
+}
+
+void HamerlyStep::processChunk(size_t chunk, const KMeansKernels &kernels,
+                               const double *allData,
+                               const CentroidMatrix &centroids,
+                               int *clusters) {
+    size_t begin, end;
+    double *sums;
+    int *counts;
+    startChunk(chunk, begin, end, sums, counts);
+
+    const size_t k = m_numClusters;
+    const size_t d = m_pointSize;
+    const bool incremental = isIncrementalStep();
+    double distSquaredSum = 0;
+    bool changed = false;
+    size_t distanceCalculations = 0;
+
+    for (size_t pointIndex = begin; pointIndex < end; pointIndex++) {
+        const double *p = allData + pointIndex * d;
+        const int oldCluster = clusters[pointIndex];
+        int newCluster = oldCluster;
+        double bestDist = 0;
+        bool scan = !m_haveBounds;
+
+        if (m_haveBounds) {
+            // the other centroids can at most have come closer by the
+            // largest distance one of them moved
+            const double drift = oldCluster == m_maxDriftCluster
+                                     ? m_secondMaxDrift
+                                     : m_maxDrift;
+            m_lower[pointIndex] = m_bounds.shrink(m_lower[pointIndex], drift);
+
+            bestDist = squaredDistance(p, centroids[oldCluster], d);
+            distanceCalculations++;
+            const double upper = m_bounds.upper(bestDist);
+            scan = !(m_lower[pointIndex] > upper ||
+                     m_halfClosestDist[oldCluster] > upper);
+        }
+
+        if (scan) {
+            // compare all centroids, keeping the second smallest distance
+            // for the lower bound
+            newCluster = -1;
+            bestDist = std::numeric_limits<double>::infinity();
+            double secondDist = std::numeric_limits<double>::infinity();
+            distanceCalculations += k;
+            for (size_t i = 0; i < k; i++) {
+                const double dist = squaredDistance(p, centroids[i], d);
+                if (dist < bestDist) {
+                    secondDist = bestDist;
+                    newCluster = i;
+                    bestDist = dist;
+                } else if (dist < secondDist) {
+                    secondDist = dist;
+                }
+            }
+            m_lower[pointIndex] = m_bounds.lower(secondDist);
+        }
+
+        distSquaredSum += bestDist;
+
+        if (newCluster != oldCluster) {
+            clusters[pointIndex] = newCluster;
+            changed = true;
+        }
+
+        accumulatePoint(p, oldCluster, newCluster, incremental, sums, counts);
+    }
+
+    endChunk(chunk, distSquaredSum, changed, distanceCalculations);
+}
+
+bool HamerlyStep::finish(CentroidMatrix &centroids,
+                         std::vector<int> &pointCounts,
+                         double &distSquaredSum) {
+    std::copy(centroids.data(), centroids.data() + m_previousCentroids.size(),
+              m_previousCentroids.begin());
+
+    if (!LloydStep::finish(centroids, pointCounts, distSquaredSum))
+        return false;
+
+    const size_t k = m_numClusters;
+    const size_t d = m_pointSize;
+    m_maxDriftCluster = -1;
+    m_maxDrift = 0;
+    m_secondMaxDrift = 0;
+    for (size_t i = 0; i < k; i++) {
+        m_drift[i] = m_bounds.upper(squaredDistance(
+            m_previousCentroids.data() + i * d, centroids[i], d));
+        if (m_drift[i] > m_maxDrift) {
+            m_secondMaxDrift = m_maxDrift;
+            m_maxDrift = m_drift[i];
+            m_maxDriftCluster = i;
+        } else if (m_drift[i] > m_secondMaxDrift) {
+            m_secondMaxDrift = m_drift[i];
+        }
+    }
+
+    std::fill(m_halfClosestDist.begin(), m_halfClosestDist.end(),
+              std::numeric_limits<double>::infinity());
+    for (size_t i = 0; i < k; i++) {
+        for (size_t j = i + 1; j < k; j++) {
+            const double half =
+                m_bounds.lower(squaredDistance(centroids[i], centroids[j], d)) /
+                2;
+            m_halfClosestDist[i] = std::min(m_halfClosestDist[i], half);
+            m_halfClosestDist[j] = std::min(m_halfClosestDist[j], half);
+        }
+    }
+
+    m_haveBounds = true;
+    return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "distance_bounds.h"
+#include "lloyd_step.h"
+
+// Hamerly's accelerated Lloyd step. Every point only keeps a lower bound on
+// the distance to the second closest centroid, next to the distance to its
+// own centroid, so it needs 2 doubles per point instead of Elkan's k. A
+// point is skipped when its centroid is closer than both that bound and half
+// the distance to the centroid closest to its own; otherwise all centroids
+// are compared. This works best for low-dimensional data with a moderate
+// number of clusters.
+//
+// As in ElkanStep, the skip tests use widened bounds, so the clusters,
+// centroids and step counts are the same as those of LloydStep.
+class HamerlyStep : public LloydStep {
+  public:
+    HamerlyStep(size_t numPoints, size_t numClusters, size_t pointSize,
+                int incrementalUpdateInterval = 0);
+
+    void processChunk(size_t chunk, const KMeansKernels &kernels,
+                      const double *allData, const CentroidMatrix &centroids,
+                      int *clusters) override;
+
+    bool finish(CentroidMatrix &centroids, std::vector<int> &pointCounts,
+                double &distSquaredSum) override;
+    void restart() override;
+
+  private:
+    DistanceBounds m_bounds;
+    bool m_haveBounds;
+
+    std::vector<double> m_lower; // numPoints
+    // how far each centroid moved in the last step, the centroid that moved
+    // the most, and the largest drift of all other centroids
+    std::vector<double> m_drift;
+    int m_maxDriftCluster;
+    double m_maxDrift;
+    double m_secondMaxDrift;
+    // half the distance from every centroid to the closest other centroid
+    std::vector<double> m_halfClosestDist;
+    std::vector<double> m_previousCentroids;
+};
@@ -1,29 +1,27 @@
 #include "helper_functions.h"
+#include <algorithm>
 #include <iostream>
 #include <math.h>
+#include <utility>
 
-void chooseCentroidsAtRandomFromDataset(Rng &rng, size_t numPoints,
-                                        size_t pointSize,
-                                        const std::vector<double> &allData,
-                                        std::vector<Point> &centroids) {
-    std::vector<size_t> pointIndices(centroids.size());
-    rng.pickRandomIndices(numPoints, pointIndices);
+void chooseCentroidsAtRandomFromDataset(Rng &rng, size_t repetition,
+                                        size_t numPoints, size_t pointSize,
+                                        const double *allData,
+                                        CentroidMatrix &centroids) {
+    std::vector<size_t> pointIndices(centroids.numCentroids());
+    rng.pickRandomIndices(repetition, numPoints, pointIndices);
 
-    // Loop over all random generated indices (of rows) and push the data points
-    // into centroids
+    // Loop over all random generated indices (of rows) and copy the data
+    // points into centroids
     for (int i = 0; i < pointIndices.size(); i++) {
-        // Get x, y, etc. value for point on specific row from allData into
-        // subvector.
-        Point pointData(allData.begin() + pointIndices[i] * pointSize,
-                        allData.begin() + pointIndices[i] * pointSize +
-                            pointSize);
-        centroids[i] = pointData;
+        const double *point = allData + pointIndices[i] * pointSize;
+        std::copy(point, point + pointSize, centroids[i]);
     }
 }
 
 void findClosestCentroidIndexAndDistance(size_t pointIndex, size_t pointSize,
-                                         const std::vector<double> &allData,
-                                         const std::vector<Point> &centroids,
+                                         const double *allData,
+                                         const CentroidMatrix &centroids,
                                          int &newCluster, double &bestDist) {
     newCluster = -1;
     bestDist = std::numeric_limits<int>::max(); // can only get better
@@ -33,7 +31,7 @@ void findClosestCentroidIndexAndDistance(size_t pointIndex, size_t pointSize,
     const size_t p = pointIndex * pointSize;
 
     // Loop over all centroid points
-    for (size_t i = 0; i < centroids.size(); i++) {
+    for (size_t i = 0; i < centroids.numCentroids(); i++) {
         double dist = 0;
 
         // Calculate quadratic euclidean distance between data point(1) and
@@ -50,14 +48,14 @@ void findClosestCentroidIndexAndDistance(size_t pointIndex, size_t pointSize,
     }
 }
 
-void moveCentroidsToAverage(std::vector<Point> &centroids,
+void moveCentroidsToAverage(CentroidMatrix &centroids,
                             std::vector<int> &clusters, size_t numPoints,
-                            size_t pointSize, const std::vector<double> &allData, std::vector<int>& pointCounts) {
+                            size_t pointSize, const double *allData,
+                            std::vector<int> &pointCounts) {
 
     // reset all centroids to 0
-    for (int i = 0; i < centroids.size(); ++i) {
-        std::fill(centroids[i].begin(), centroids[i].end(), 0); // reset centroid to 0
-    }
+    std::fill(centroids.data(),
+              centroids.data() + centroids.numCentroids() * pointSize, 0);
 
     // set per centroid point counters to 0
     std::fill(pointCounts.begin(), pointCounts.end(), 0);
@@ -76,9 +74,99 @@ void moveCentroidsToAverage(std::vector<Point> &centroids,
     }
 
     // average out the centroids
-    for (int i = 0; i < centroids.size(); ++i) {
+    for (int i = 0; i < centroids.numCentroids(); ++i) {
         if (pointCounts[i] > 0)
             for (size_t dim = 0; dim < pointSize; dim++)
                 centroids[i][dim] /= pointCounts[i];
     }
-}
\ No newline at end of file
+}
+
+namespace {
+
+// D > 0: specialised for points of size D, D == 0: any point size
+template <size_t D>
+void assignAndAccumulateDim(ClosestCentroidKernel closestCentroid,
+                            const double *allData, size_t begin, size_t end,
+                            size_t pointSize, const CentroidMatrix &centroids,
+                            int *clusters, double *sums, int *counts,
+                            double &distSquaredSum, bool &changed) {
+    const size_t dims = D > 0 ? D : pointSize;
+
+    for (size_t pointIndex = begin; pointIndex < end; pointIndex++) {
+        const double *p = allData + pointIndex * dims;
+        int newCluster;
+        double dist;
+
+        closestCentroid(p, dims, centroids, newCluster, dist);
+
+        distSquaredSum += dist;
+
+        if (newCluster != clusters[pointIndex]) {
+            clusters[pointIndex] = newCluster;
+            changed = true;
+        }
+
+        // add all dimensions to the sum of the new cluster
+        double *sum = sums + newCluster * dims;
+        for (size_t dim = 0; dim < dims; ++dim)
+            sum[dim] += p[dim];
+        counts[newCluster] += 1;
+    }
+}
+
+// Like assignAndAccumulateDim, but only the points that change cluster are
+// moved from the sum of their old cluster to that of their new one
+template <size_t D>
+void assignAndAccumulateChangesDim(ClosestCentroidKernel closestCentroid,
+                                   const double *allData, size_t begin,
+                                   size_t end, size_t pointSize,
+                                   const CentroidMatrix &centroids,
+                                   int *clusters, double *sums, int *counts,
+                                   double &distSquaredSum, bool &changed) {
+    const size_t dims = D > 0 ? D : pointSize;
+
+    for (size_t pointIndex = begin; pointIndex < end; pointIndex++) {
+        const double *p = allData + pointIndex * dims;
+        int newCluster;
+        double dist;
+
+        closestCentroid(p, dims, centroids, newCluster, dist);
+
+        distSquaredSum += dist;
+
+        const int oldCluster = clusters[pointIndex];
+        if (newCluster != oldCluster) {
+            clusters[pointIndex] = newCluster;
+            changed = true;
+
+            if (oldCluster >= 0) {
+                double *sum = sums + oldCluster * dims;
+                for (size_t dim = 0; dim < dims; ++dim)
+                    sum[dim] -= p[dim];
+                counts[oldCluster] -= 1;
+            }
+            double *sum = sums + newCluster * dims;
+            for (size_t dim = 0; dim < dims; ++dim)
+                sum[dim] += p[dim];
+            counts[newCluster] += 1;
+        }
+    }
+}
+
+template <size_t... D>
+KMeansKernels selectKernels(size_t pointSize, std::index_sequence<D...>) {
+    const AssignAndAccumulateKernel full[] = {assignAndAccumulateDim<D>...};
+    const AssignAndAccumulateKernel changes[] = {
+        assignAndAccumulateChangesDim<D>...};
+    const size_t i = pointSize < sizeof...(D) ? pointSize : 0;
+
+    return {getClosestCentroidKernel(detectSimdLevel(), pointSize), full[i],
+            changes[i]};
+}
+
+} // namespace
+
+KMeansKernels selectKernels(size_t pointSize) {
+    return selectKernels(
+        pointSize, std::make_index_sequence<maxSpecializedPointSize + 1>());
+}
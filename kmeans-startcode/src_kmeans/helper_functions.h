@@ -1,12 +1,32 @@
 #pragma once
 
 #include "types.h"
+#include "distance_kernels.h"
 #include <cstdlib>
 #include "rng.h"
 
-void chooseCentroidsAtRandomFromDataset(Rng& rng, size_t numPoints, size_t pointSize, const std::vector<double> &allData, std::vector<Point> &centroids);
+// Picks the initial centroids of a repetition (see Rng::pickRandomIndices)
+void chooseCentroidsAtRandomFromDataset(Rng& rng, size_t repetition, size_t numPoints, size_t pointSize, const double *allData, CentroidMatrix &centroids);
 
 
-void findClosestCentroidIndexAndDistance(size_t pointIndex, size_t pointSize, const std::vector<double> &allData, const std::vector<Point> &centroids, int &newCluster, double &bestDist);
+// Scalar reference implementation
+void findClosestCentroidIndexAndDistance(size_t pointIndex, size_t pointSize, const double *allData, const CentroidMatrix &centroids, int &newCluster, double &bestDist);
 
-void moveCentroidsToAverage(std::vector<Point>& centroids, std::vector<int> &clusters, size_t numPoints, size_t pointSize, const std::vector<double> &allData, std::vector<int>& pointCounts);
\ No newline at end of file
+void moveCentroidsToAverage(CentroidMatrix& centroids, std::vector<int> &clusters, size_t numPoints, size_t pointSize, const double *allData, std::vector<int>& pointCounts);
+
+// Assigns the points in [begin, end) to their closest centroid (updating
+// 'clusters', 'distSquaredSum' and 'changed'), and at the same time adds each
+// point to 'sums' (numClusters x pointSize) and 'counts' of its new cluster.
+typedef void (*AssignAndAccumulateKernel)(ClosestCentroidKernel closestCentroid, const double *allData, size_t begin, size_t end, size_t pointSize, const CentroidMatrix &centroids, int *clusters, double *sums, int *counts, double &distSquaredSum, bool &changed);
+
+// Kernels specialised for the point size of the dataset (and the SIMD level
+// of the CPU). Selected once after reading the dataset and used by all CPU
+// backends.
+struct KMeansKernels {
+    ClosestCentroidKernel closestCentroid;
+    AssignAndAccumulateKernel assignAndAccumulate;
+    // only accumulates the changes of the points that move to another cluster
+    AssignAndAccumulateKernel assignAndAccumulateChanges;
+};
+
+KMeansKernels selectKernels(size_t pointSize);
\ No newline at end of file
@@ -0,0 +1,123 @@
+#include "kd_tree.h"
+#include <algorithm>
+
+namespace {
+
+// Nodes with at most this many points are not split further
+const size_t maxLeafPoints = 16;
+
+} // namespace
+
+KdTree::KdTree(const double *allData, size_t numPoints, size_t pointSize)
+    : m_pointSize{pointSize}, m_depth{0}, m_index(numPoints) {
+    for (size_t i = 0; i < numPoints; i++)
+        m_index[i] = i;
+
+    // a binary tree with leaves of at least maxLeafPoints / 2 points
+    const size_t maxNodes = 4 * numPoints / maxLeafPoints + 1;
+    m_begin.reserve(maxNodes);
+    m_end.reserve(maxNodes);
+    m_left.reserve(maxNodes);
+    m_right.reserve(maxNodes);
+
+    // the points are only moved in m_index while building, and then copied
+    // in the final order
+    m_points.assign(allData, allData + numPoints * pointSize);
+    build(0, numPoints, 0);
+    for (size_t pos = 0; pos < numPoints; pos++)
+        std::copy(allData + m_index[pos] * pointSize,
+                  allData + (m_index[pos] + 1) * pointSize,
+                  m_points.begin() + pos * pointSize);
+
+    // the boxes, sums, means and scatters, children before their parents
+    const size_t d = pointSize;
+    m_lower.resize(numNodes() * d);
+    m_upper.resize(numNodes() * d);
+    m_sum.resize(numNodes() * d);
+    m_mean.resize(numNodes() * d);
+    m_scatter.resize(numNodes());
+    for (size_t n = numNodes(); n-- > 0;) {
+        double *lo = m_lower.data() + n * d;
+        double *hi = m_upper.data() + n * d;
+        double *sum = m_sum.data() + n * d;
+        double *mean = m_mean.data() + n * d;
+        const double count = m_end[n] - m_begin[n];
+
+        if (isLeaf(n)) {
+            std::copy(point(m_begin[n]), point(m_begin[n]) + d, lo);
+            std::copy(point(m_begin[n]), point(m_begin[n]) + d, hi);
+            std::fill(sum, sum + d, 0);
+            for (size_t pos = m_begin[n]; pos < m_end[n]; pos++) {
+                for (size_t dim = 0; dim < d; dim++) {
+                    lo[dim] = std::min(lo[dim], point(pos)[dim]);
+                    hi[dim] = std::max(hi[dim], point(pos)[dim]);
+                    sum[dim] += point(pos)[dim];
+                }
+            }
+            for (size_t dim = 0; dim < d; dim++)
+                mean[dim] = sum[dim] / count;
+            m_scatter[n] = 0;
+            for (size_t pos = m_begin[n]; pos < m_end[n]; pos++)
+                m_scatter[n] += squaredDistance(point(pos), mean, d);
+        } else {
+            const size_t l = m_left[n];
+            const size_t r = m_right[n];
+            for (size_t dim = 0; dim < d; dim++) {
+                lo[dim] = std::min(lower(l)[dim], lower(r)[dim]);
+                hi[dim] = std::max(upper(l)[dim], upper(r)[dim]);
+                sum[dim] = this->sum(l)[dim] + this->sum(r)[dim];
+                mean[dim] = sum[dim] / count;
+            }
+            // parallel axis theorem
+            const double countLeft = m_end[l] - m_begin[l];
+            const double countRight = m_end[r] - m_begin[r];
+            m_scatter[n] =
+                m_scatter[l] + m_scatter[r] +
+                countLeft * squaredDistance(this->mean(l), mean, d) +
+                countRight * squaredDistance(this->mean(r), mean, d);
+        }
+    }
+}
+
+int KdTree::build(size_t begin, size_t end, size_t depth) {
+    const int node = m_begin.size();
+    m_begin.push_back(begin);
+    m_end.push_back(end);
+    m_left.push_back(-1);
+    m_right.push_back(-1);
+    m_depth = std::max(m_depth, depth);
+    if (end - begin <= maxLeafPoints)
+        return node;
+
+    // split the widest dimension at the median
+    const size_t d = m_pointSize;
+    size_t splitDim = 0;
+    double widest = -1;
+    for (size_t dim = 0; dim < d; dim++) {
+        double lo = m_points[m_index[begin] * d + dim], hi = lo;
+        for (size_t pos = begin + 1; pos < end; pos++) {
+            lo = std::min(lo, m_points[m_index[pos] * d + dim]);
+            hi = std::max(hi, m_points[m_index[pos] * d + dim]);
+        }
+        if (hi - lo > widest) {
+            widest = hi - lo;
+            splitDim = dim;
+        }
+    }
+    if (widest <= 0) // all points are the same
+        return node;
+
+    const size_t middle = begin + (end - begin) / 2;
+    std::nth_element(m_index.begin() + begin, m_index.begin() + middle,
+                     m_index.begin() + end, [&](size_t a, size_t b) {
+                         const double va = m_points[a * d + splitDim];
+                         const double vb = m_points[b * d + splitDim];
+                         return va < vb || (va == vb && a < b);
+                     });
+
+    const int left = build(begin, middle, depth + 1);
+    const int right = build(middle, end, depth + 1);
+    m_left[node] = left;
+    m_right[node] = right;
+    return node;
+}
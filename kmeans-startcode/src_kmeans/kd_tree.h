@@ -0,0 +1,70 @@
+#pragma once
+
+#include "lloyd_step.h"
+#include <vector>
+
+// A kd-tree over the points of a dataset, for the filtering engine. Every
+// node keeps the bounding box, the sum, the mean and the scatter (the sum of
+// the squared distances to the mean) of its points, so a whole subtree can be
+// assigned to a centroid and added to its sum without visiting its points.
+//
+// The points are reordered so that those of every node are consecutive:
+// position 'pos' in the tree holds point index(pos), which is also copied to
+// point(pos). Nodes are stored in pre-order, the root is node 0. The tree is
+// built once per run and only read afterwards, by all repetitions and
+// threads.
+class KdTree : public EngineData {
+  public:
+    KdTree(const double *allData, size_t numPoints, size_t pointSize);
+
+    size_t numPoints() const { return m_index.size(); }
+    size_t pointSize() const { return m_pointSize; }
+    size_t numNodes() const { return m_begin.size(); }
+    size_t depth() const { return m_depth; }
+
+    bool isLeaf(size_t node) const { return m_left[node] < 0; }
+    int left(size_t node) const { return m_left[node]; }
+    int right(size_t node) const { return m_right[node]; }
+    // the points of a node are at positions [begin, end)
+    size_t begin(size_t node) const { return m_begin[node]; }
+    size_t end(size_t node) const { return m_end[node]; }
+
+    const double *lower(size_t node) const {
+        return m_lower.data() + node * m_pointSize;
+    }
+    const double *upper(size_t node) const {
+        return m_upper.data() + node * m_pointSize;
+    }
+    const double *sum(size_t node) const {
+        return m_sum.data() + node * m_pointSize;
+    }
+    const double *mean(size_t node) const {
+        return m_mean.data() + node * m_pointSize;
+    }
+    double scatter(size_t node) const { return m_scatter[node]; }
+
+    size_t index(size_t pos) const { return m_index[pos]; }
+    const double *point(size_t pos) const {
+        return m_points.data() + pos * m_pointSize;
+    }
+
+  private:
+    int build(size_t begin, size_t end, size_t depth);
+
+    size_t m_pointSize;
+    size_t m_depth;
+
+    std::vector<size_t> m_index;
+    std::vector<double> m_points; // numPoints x pointSize, in tree order
+
+    // per node
+    std::vector<size_t> m_begin;
+    std::vector<size_t> m_end;
+    std::vector<int> m_left;
+    std::vector<int> m_right;
+    std::vector<double> m_lower; // pointSize
+    std::vector<double> m_upper; // pointSize
+    std::vector<double> m_sum;   // pointSize
+    std::vector<double> m_mean;  // pointSize
+    std::vector<double> m_scatter;
+};
@@ -0,0 +1,216 @@
+#include "kdtree_step.h"
+#include <cfloat>
+#include <limits>
+
+struct KdTreeStep::ChunkState {
+    size_t begin, end; // positions in the tree
+    const CentroidMatrix &centroids;
+    int *clusters;
+    double *sums;
+    int *counts;
+    std::vector<int> candidates; // (depth + 1) x numClusters scratch space
+    std::vector<double> corner;  // pointSize scratch space
+    double distSquaredSum;
+    bool changed;
+    size_t distanceCalculations;
+};
+
+KdTreeStep::KdTreeStep(const KdTree &tree, size_t numClusters)
+    : LloydStep(tree.numPoints(), numClusters, tree.pointSize()),
+      m_tree{tree}, m_tolerance{4 * (tree.pointSize() + 8) * DBL_EPSILON},
+      m_owner(tree.numNodes(), -1) {}
+
+void KdTreeStep::restart() {
+    LloydStep::restart();
+    std::fill(m_owner.begin(), m_owner.end(), -1);
+}
+
+// the points are read from the tree, in the order of their positions
+void KdTreeStep::processChunk(size_t chunk, const KMeansKernels &,
+                              const double *,
+                              const CentroidMatrix &centroids,
+                              int *clusters) {
+    size_t begin, end;
+    double *sums;
+    int *counts;
+    startChunk(chunk, begin, end, sums, counts);
+
+    ChunkState state{begin, end, centroids, clusters, sums, counts,
+                     std::vector<int>((m_tree.depth() + 2) * m_numClusters),
+                     std::vector<double>(m_pointSize), 0, false, 0};
+    for (size_t i = 0; i < m_numClusters; i++)
+        state.candidates[i] = i;
+    if (begin < end)
+        filter(state, 0, 0, m_numClusters, -1);
+
+    endChunk(chunk, state.distSquaredSum, state.changed,
+             state.distanceCalculations);
+}
+
+void KdTreeStep::copyChunkClusters(size_t first, size_t last,
+                                   const std::vector<int> &clusters,
+                                   std::vector<int> &out) const {
+    size_t begin, end, unused;
+    chunkRange(first, begin, unused);
+    chunkRange(last, end, unused);
+    for (size_t pos = begin; pos < end; pos++)
+        out[m_tree.index(pos)] = clusters[m_tree.index(pos)];
+}
+
+void KdTreeStep::filter(ChunkState &state, size_t node, size_t depth,
+                        size_t numCandidates, int inheritedOwner) {
+    const size_t nodeBegin = m_tree.begin(node);
+    const size_t nodeEnd = m_tree.end(node);
+    if (nodeEnd <= state.begin || nodeBegin >= state.end)
+        return;
+
+    // the owner is only tracked for nodes that lie within a single chunk,
+    // so that no two threads write it
+    const bool inChunk = nodeBegin >= state.begin && nodeEnd <= state.end;
+    const int owner = inheritedOwner >= 0 ? inheritedOwner : m_owner[node];
+
+    const int *candidates = state.candidates.data() + depth * m_numClusters;
+    int *kept = state.candidates.data() + (depth + 1) * m_numClusters;
+    if (numCandidates > 1)
+        numCandidates = pruneCandidates(state.centroids, node, candidates,
+                                        numCandidates, kept,
+                                        state.corner.data());
+    else
+        kept[0] = candidates[0];
+
+    if (numCandidates == 1 && inChunk) {
+        assignNode(state, node, kept[0], owner);
+        m_owner[node] = kept[0];
+    } else if (m_tree.isLeaf(node)) {
+        assignPoints(state, node, kept, numCandidates);
+        if (inChunk) {
+            // whether all points ended up in the same cluster
+            int leafOwner = state.clusters[m_tree.index(nodeBegin)];
+            for (size_t pos = nodeBegin; pos < nodeEnd; pos++)
+                if (state.clusters[m_tree.index(pos)] != leafOwner)
+                    leafOwner = -1;
+            m_owner[node] = leafOwner;
+        }
+    } else {
+        const int childOwner = inChunk ? owner : -1;
+        filter(state, m_tree.left(node), depth + 1, numCandidates, childOwner);
+        filter(state, m_tree.right(node), depth + 1, numCandidates,
+               childOwner);
+        if (inChunk) {
+            const int left = m_owner[m_tree.left(node)];
+            m_owner[node] = left == m_owner[m_tree.right(node)] ? left : -1;
+        }
+    }
+}
+
+size_t KdTreeStep::pruneCandidates(const CentroidMatrix &centroids,
+                                   size_t node, const int *candidates,
+                                   size_t numCandidates, int *kept,
+                                   double *v) const {
+    const size_t d = m_pointSize;
+    const double *lo = m_tree.lower(node);
+    const double *hi = m_tree.upper(node);
+
+    // the candidate closest to the middle of the box
+    for (size_t dim = 0; dim < d; dim++)
+        v[dim] = (lo[dim] + hi[dim]) / 2;
+    int closest = candidates[0];
+    double closestDist = std::numeric_limits<double>::infinity();
+    for (size_t c = 0; c < numCandidates; c++) {
+        const double dist =
+            squaredDistance(v, centroids[candidates[c]], d);
+        if (dist < closestDist) {
+            closest = candidates[c];
+            closestDist = dist;
+        }
+    }
+    const double *z = centroids[closest];
+
+    // the largest squared distance from a point in the box to it
+    double radius = 0;
+    for (size_t dim = 0; dim < d; dim++) {
+        const double diff = std::max(z[dim] - lo[dim], hi[dim] - z[dim]);
+        radius += diff * diff;
+    }
+
+    // A candidate is further than 'closest' from every point in the box if
+    // it is at the corner of the box that lies furthest towards it. As the
+    // difference in squared distance is linear over the box, requiring a
+    // margin relative to the largest distance in the box there makes the
+    // computed distances of every point differ in the same direction.
+    size_t numKept = 0;
+    for (size_t c = 0; c < numCandidates; c++) {
+        const int i = candidates[c];
+        if (i != closest) {
+            for (size_t dim = 0; dim < d; dim++)
+                v[dim] = centroids[i][dim] > z[dim] ? hi[dim] : lo[dim];
+            const double dist = squaredDistance(v, centroids[i], d);
+            const double closestDistAtCorner = squaredDistance(v, z, d);
+            if (dist * (1 - m_tolerance) >
+                closestDistAtCorner * (1 + m_tolerance) +
+                    3 * m_tolerance * radius)
+                continue;
+        }
+        kept[numKept++] = i;
+    }
+    return numKept;
+}
+
+void KdTreeStep::assignNode(ChunkState &state, size_t node, int cluster,
+                            int owner) {
+    const size_t d = m_pointSize;
+    const size_t count = m_tree.end(node) - m_tree.begin(node);
+
+    double *sum = state.sums + cluster * d;
+    const double *nodeSum = m_tree.sum(node);
+    for (size_t dim = 0; dim < d; dim++)
+        sum[dim] += nodeSum[dim];
+    state.counts[cluster] += count;
+    state.distSquaredSum +=
+        m_tree.scatter(node) +
+        count * squaredDistance(m_tree.mean(node), state.centroids[cluster], d);
+
+    // the labels only need to be written if they were not all this cluster
+    if (owner == cluster)
+        return;
+    for (size_t pos = m_tree.begin(node); pos < m_tree.end(node); pos++) {
+        int &label = state.clusters[m_tree.index(pos)];
+        if (label != cluster) {
+            label = cluster;
+            state.changed = true;
+        }
+    }
+}
+
+void KdTreeStep::assignPoints(ChunkState &state, size_t node,
+                              const int *candidates, size_t numCandidates) {
+    const size_t d = m_pointSize;
+    const size_t begin = std::max(m_tree.begin(node), state.begin);
+    const size_t end = std::min(m_tree.end(node), state.end);
+
+    for (size_t pos = begin; pos < end; pos++) {
+        const double *p = m_tree.point(pos);
+        int newCluster = -1;
+        double bestDist = std::numeric_limits<double>::infinity();
+
+        // the candidates are in increasing order, so ties go to the lowest
+        // index like in the full scan
+        for (size_t c = 0; c < numCandidates; c++) {
+            const double dist =
+                squaredDistance(p, state.centroids[candidates[c]], d);
+            if (dist < bestDist) {
+                newCluster = candidates[c];
+                bestDist = dist;
+            }
+        }
+        state.distanceCalculations += numCandidates;
+        state.distSquaredSum += bestDist;
+
+        int &label = state.clusters[m_tree.index(pos)];
+        if (label != newCluster) {
+            label = newCluster;
+            state.changed = true;
+        }
+        accumulatePoint(p, -1, newCluster, false, state.sums, state.counts);
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "kd_tree.h"
+
+// The filtering algorithm of Kanungo et al. Every step walks the shared
+// kd-tree with a list of candidate centroids, and drops the candidates that
+// are further from every point in a node's box than another candidate. A
+// node with a single candidate left is assigned as a whole: its sum and count
+// are added to that centroid, and its distance sum follows from its mean and
+// scatter, without visiting its points. Only leaves that keep several
+// candidates compare their points one by one.
+//
+// Candidates are only dropped when they are further with a margin that covers
+// the rounding of the distances, so every point gets the same centroid as
+// in LloydStep. The centroids are summed in another order though, so they
+// (and with them, later steps) can differ in the last bits.
+// --incremental has no effect on this engine.
+class KdTreeStep : public LloydStep {
+  public:
+    KdTreeStep(const KdTree &tree, size_t numClusters);
+
+    void processChunk(size_t chunk, const KMeansKernels &kernels,
+                      const double *allData, const CentroidMatrix &centroids,
+                      int *clusters) override;
+    void restart() override;
+
+    // the chunks are ranges of positions in the tree, not of points
+    void copyChunkClusters(size_t first, size_t last,
+                           const std::vector<int> &clusters,
+                           std::vector<int> &out) const override;
+
+  private:
+    struct ChunkState;
+
+    // processes the points of 'node' within [begin, end) of the chunk; the
+    // candidates are in the scratch space of the node's depth
+    void filter(ChunkState &state, size_t node, size_t depth,
+                size_t numCandidates, int inheritedOwner);
+    // 'v' is scratch space of pointSize values, from the chunk
+    size_t pruneCandidates(const CentroidMatrix &centroids, size_t node,
+                           const int *candidates, size_t numCandidates,
+                           int *kept, double *v) const;
+    void assignNode(ChunkState &state, size_t node, int cluster, int owner);
+    void assignPoints(ChunkState &state, size_t node, const int *candidates,
+                      size_t numCandidates);
+
+    const KdTree &m_tree;
+    // relative margin on the computed squared distances
+    double m_tolerance;
+
+    // per node: the cluster of all its points after the last step it was
+    // fully within a chunk, -1 if mixed or unknown
+    std::vector<int> m_owner;
+};
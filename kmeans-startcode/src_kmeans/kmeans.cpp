@@ -1,10 +1,17 @@
 #include "kmeans.h"
-#include "CSVReader.hpp"
+#include "autotune.h"
+#include "BinaryDataset.h"
+#include "MappedCSVReader.h"
 #include "CSVWriter.hpp"
 #include "helper_functions.h"
+#include "lloyd_step.h"
+#include "numa.h"
 #include "timer.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 
-#if KMEANS_MODE_MPI == 1
+#if KMEANS_WITH_MPI == 1
 #include <mpi.h>
 #endif
 
@@ -12,48 +19,424 @@ KMeansArgs::KMeansArgs(Rng &rng, const std::string &inputFileName,
                        const std::string &outputFileName, int numClusters,
                        int repetitions, int numBlocks, int numThreads,
                        const std::string &centroidDebugFileName,
-                       const std::string &clusterDebugFileName)
+                       const std::string &clusterDebugFileName,
+                       bool useDataCache, const KMeansOptions &options)
     : rng{rng}, inputFileName{inputFileName}, outputFileName{outputFileName},
       numClusters{numClusters}, repetitions{repetitions}, numBlocks{numBlocks},
       numThreads{numThreads}, centroidDebugFileName{centroidDebugFileName},
-      clusterDebugFileName{clusterDebugFileName} {}
+      clusterDebugFileName{clusterDebugFileName}, useDataCache{useDataCache},
+      options{options} {}
 
-// Helper function to read input file into allData, setting number of detected
-// rows and columns. Feel free to use, adapt or ignore
-void readData(std::ifstream &input, std::vector<double> &allData,
-              size_t &numRows, size_t &numCols) {
-    if (!input.is_open())
-        throw std::runtime_error("Input file is not open");
+bool parseEngineName(const std::string &name, KMeansEngine &engine) {
+    if (name == "lloyd")
+        engine = KMeansEngine::Lloyd;
+    else if (name == "elkan")
+        engine = KMeansEngine::Elkan;
+    else if (name == "hamerly")
+        engine = KMeansEngine::Hamerly;
+    else if (name == "yinyang")
+        engine = KMeansEngine::Yinyang;
+    else if (name == "kdtree")
+        engine = KMeansEngine::KdTree;
+    else if (name == "gemm")
+        engine = KMeansEngine::Gemm;
+    else
+        return false;
+    return true;
+}
+
+const char *engineName(KMeansEngine engine) {
+    switch (engine) {
+    case KMeansEngine::Elkan:
+        return "elkan";
+    case KMeansEngine::Hamerly:
+        return "hamerly";
+    case KMeansEngine::Yinyang:
+        return "yinyang";
+    case KMeansEngine::KdTree:
+        return "kdtree";
+    case KMeansEngine::Gemm:
+        return "gemm";
+    case KMeansEngine::Lloyd:
+    default:
+        return "lloyd";
+    }
+}
+
+bool parseBackendName(const std::string &name, KMeansBackend &backend) {
+    if (name == "auto")
+        backend = KMeansBackend::Auto;
+    else if (name == "serial")
+        backend = KMeansBackend::Serial;
+    else if (name == "openmp")
+        backend = KMeansBackend::OpenMP;
+    else if (name == "mpi")
+        backend = KMeansBackend::MPI;
+    else if (name == "cuda")
+        backend = KMeansBackend::CUDA;
+    else
+        return false;
+    return true;
+}
+
+const char *backendName(KMeansBackend backend) {
+    switch (backend) {
+    case KMeansBackend::Auto:
+        return "auto";
+    case KMeansBackend::OpenMP:
+        return "openmp";
+    case KMeansBackend::MPI:
+        return "mpi";
+    case KMeansBackend::CUDA:
+        return "cuda";
+    case KMeansBackend::Serial:
+    default:
+        return "serial";
+    }
+}
+
+KMeansBackend defaultBackend() {
+#if KMEANS_MODE_AUTO == 1
+    return KMeansBackend::Auto;
+#elif KMEANS_MODE_OPENMP == 1
+    return KMeansBackend::OpenMP;
+#elif KMEANS_MODE_CUDA == 1
+    return KMeansBackend::CUDA;
+#elif KMEANS_MODE_MPI == 1
+    return KMeansBackend::MPI;
+#else
+    return KMeansBackend::Serial;
+#endif
+}
+
+bool isBackendAvailable(KMeansBackend backend) {
+    switch (backend) {
+    case KMeansBackend::Auto:
+    case KMeansBackend::Serial:
+        return true;
+    case KMeansBackend::OpenMP:
+#ifdef _OPENMP
+        return true;
+#else
+        return false;
+#endif
+    case KMeansBackend::MPI:
+#if KMEANS_WITH_MPI == 1
+        return true;
+#else
+        return false;
+#endif
+    case KMeansBackend::CUDA:
+#if KMEANS_MODE_CUDA == 1
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+bool parseInitName(const std::string &name, KMeansInit &init) {
+    if (name == "random")
+        init = KMeansInit::Random;
+    else if (name == "kmeans++")
+        init = KMeansInit::KMeansPlusPlus;
+    else if (name == "kmeans-parallel")
+        init = KMeansInit::KMeansParallel;
+    else
+        return false;
+    return true;
+}
+
+bool parseMPIModeName(const std::string &name, MPIMode &mode) {
+    if (name == "auto")
+        mode = MPIMode::Auto;
+    else if (name == "repetitions")
+        mode = MPIMode::Repetitions;
+    else if (name == "data")
+        mode = MPIMode::Data;
+    else
+        return false;
+    return true;
+}
+
+bool parsePinningName(const std::string &name, ThreadPinning &pinning) {
+    if (name == "none")
+        pinning = ThreadPinning::None;
+    else if (name == "compact")
+        pinning = ThreadPinning::Compact;
+    else if (name == "scatter")
+        pinning = ThreadPinning::Scatter;
+    else
+        return false;
+    return true;
+}
+
+const char *pinningName(ThreadPinning pinning) {
+    switch (pinning) {
+    case ThreadPinning::Compact:
+        return "compact";
+    case ThreadPinning::Scatter:
+        return "scatter";
+    case ThreadPinning::None:
+    default:
+        return "none";
+    }
+}
 
-    allData.resize(0);
+bool parseNumaPlacementName(const std::string &name,
+                            NumaPlacement &placement) {
+    if (name == "auto")
+        placement = NumaPlacement::Auto;
+    else if (name == "firsttouch")
+        placement = NumaPlacement::FirstTouch;
+    else if (name == "interleave")
+        placement = NumaPlacement::Interleave;
+    else if (name == "none")
+        placement = NumaPlacement::None;
+    else
+        return false;
+    return true;
+}
+
+#if KMEANS_WITH_MPI == 1
+// Reads the bytes [begin, end) of the file into 'text' with collective
+// reads, so that MPI-IO can combine the requests of the processes. All
+// processes make 'numReads' calls, enough for the largest range.
+void readFileRange(MPI_File file, MPI_Offset begin, MPI_Offset end,
+                   MPI_Offset numReads, std::vector<char> &text) {
+    const MPI_Offset maxRead = 1 << 30;
+    text.resize(end - begin);
+    for (MPI_Offset i = 0; i < numReads; i++) {
+        const MPI_Offset pos = std::min(begin + i * maxRead, end);
+        const int count = std::min(maxRead, end - pos);
+        MPI_File_read_at_all(file, pos, text.data() + (pos - begin), count,
+                             MPI_CHAR, MPI_STATUS_IGNORE);
+    }
+}
+
+// Throws the error of the first process that has one, on all processes
+// together, so that none of them is left waiting in a later collective call
+void throwFirstError(std::string error) {
+    int rank, numProcesses;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &numProcesses);
+    int failed = error.empty() ? numProcesses : rank;
+    MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if (failed == numProcesses)
+        return;
+
+    int length = error.size();
+    MPI_Bcast(&length, 1, MPI_INT, failed, MPI_COMM_WORLD);
+    error.resize(length);
+    MPI_Bcast(&error[0], length, MPI_CHAR, failed, MPI_COMM_WORLD);
+    throw std::runtime_error(error);
+}
+
+// Every process reads and parses only the lines that start in its share of
+// the bytes of a CSV file. Then the rows of all processes are gathered in
+// file order or, with 'dataParallelClusters', every process gets the rows of
+// its dataParallelPointRange, from 'firstRow' on. Returns false if the file
+// can't be opened.
+bool readCSVPartitioned(const std::string &fileName, int dataParallelClusters,
+                        std::vector<double> &allData, size_t &numRows,
+                        size_t &numCols, size_t &firstRow) {
+    int rank, numProcesses;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &numProcesses);
+
+    MPI_File file;
+    if (MPI_File_open(MPI_COMM_WORLD, fileName.c_str(), MPI_MODE_RDONLY,
+                      MPI_INFO_NULL, &file) != MPI_SUCCESS)
+        return false;
+    MPI_Offset fileSize;
+    MPI_File_get_size(file, &fileSize);
+    const MPI_Offset begin = fileSize * rank / numProcesses;
+    const MPI_Offset end = fileSize * (rank + 1) / numProcesses;
+
+    // with the byte before the range, to see if a line starts at 'begin'
+    const MPI_Offset readBegin = std::max<MPI_Offset>(begin - 1, 0);
+    const MPI_Offset maxRange = fileSize / numProcesses + 2;
+    std::vector<char> text;
+    readFileRange(file, readBegin, end, maxRange / (1 << 30) + 1, text);
+
+    // the last line continues up to the next newline
+    MPI_Offset readEnd = end;
+    while (begin < end && text.back() != '\n' && readEnd < fileSize) {
+        const MPI_Offset blockEnd = std::min<MPI_Offset>(readEnd + 4096, fileSize);
+        const size_t offset = text.size();
+        text.resize(offset + (blockEnd - readEnd));
+        MPI_File_read_at(file, readEnd, text.data() + offset,
+                         blockEnd - readEnd, MPI_CHAR, MPI_STATUS_IGNORE);
+        const char *newline = (const char *)memchr(
+            text.data() + offset, '\n', blockEnd - readEnd);
+        readEnd = blockEnd;
+        if (newline) {
+            text.resize(newline + 1 - text.data());
+            break;
+        }
+    }
+    MPI_File_close(&file);
+
+    // skip the line that started in the range of the previous process
+    const char *lines = text.data() + (begin - readBegin);
+    const char *linesEnd = text.data() + text.size();
+    if (begin > 0 && lines[-1] != '\n') {
+        const char *newline = (const char *)memchr(lines, '\n', linesEnd - lines);
+        lines = newline ? newline + 1 : linesEnd;
+    }
+    if (lines - text.data() >= end - readBegin)
+        lines = linesEnd; // no line starts in the range
+
+    // the line numbers in errors count the data lines of the processes
+    // before this one too
+    MappedCSVReader reader;
+    unsigned long long numLines = reader.countDataLines(lines, linesEnd);
+    unsigned long long lineOffset = 0;
+    MPI_Exscan(&numLines, &lineOffset, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM,
+               MPI_COMM_WORLD);
+    if (rank == 0)
+        lineOffset = 0; // not set by MPI_Exscan
+
+    std::vector<double> values;
+    size_t localRows = 0, localCols = 0;
+    std::string error;
+    try {
+        reader.parse(lines, linesEnd, values, localRows, localCols, 1,
+                     lineOffset);
+    } catch (const std::exception &e) {
+        error = e.what();
+    }
+
+    // processes without any rows accept the number of columns of the others
+    unsigned long long cols[2] = {localCols, localCols > 0 ? ~localCols : 0};
+    MPI_Allreduce(MPI_IN_PLACE, cols, 2, MPI_UNSIGNED_LONG_LONG, MPI_MAX,
+                  MPI_COMM_WORLD);
+    numCols = cols[0];
+    if (error.empty() && numCols == 0)
+        error = "Unexpected error: 0 columns";
+    if (error.empty() &&
+        ((localCols > 0 && localCols != numCols) || ~cols[1] != numCols))
+        error = "Incompatible number of columns in " + fileName;
+    throwFirstError(error);
+
+    // gather the rows of all processes, in their order in the file
+    std::vector<int> rowCounts(numProcesses), rowOffsets(numProcesses);
+    int count = localRows;
+    MPI_Allgather(&count, 1, MPI_INT, rowCounts.data(), 1, MPI_INT,
+                  MPI_COMM_WORLD);
     numRows = 0;
-    numCols = -1;
+    for (int i = 0; i < numProcesses; i++) {
+        rowOffsets[i] = numRows;
+        numRows += rowCounts[i];
+    }
 
-    CSVReader inReader(input);
-    int numColsExpected = -1;
-    int line = 1;
-    std::vector<double> row;
+    MPI_Datatype row;
+    MPI_Type_contiguous(numCols, MPI_DOUBLE, &row);
+    MPI_Type_commit(&row);
+    if (dataParallelClusters == 0) {
+        firstRow = 0;
+        allData.resize(numRows * numCols);
+        MPI_Allgatherv(values.data(), count, row, allData.data(),
+                       rowCounts.data(), rowOffsets.data(), row,
+                       MPI_COMM_WORLD);
+        MPI_Type_free(&row);
+        return true;
+    }
 
-    while (inReader.read(row)) {
-        if (numColsExpected == -1) {
-            numColsExpected = row.size();
-            if (numColsExpected <= 0)
-                throw std::runtime_error("Unexpected error: 0 columns");
-        } else if (numColsExpected != (int)row.size())
-            throw std::runtime_error(
-                "Incompatible number of colums read in line " +
-                std::to_string(line) + ": expecting " +
-                std::to_string(numColsExpected) + " but got " +
-                std::to_string(row.size()));
+    // every process sends every other one the part of its rows that the
+    // other keeps
+    size_t lastRow;
+    dataParallelPointRange(numRows, numCols, dataParallelClusters, rank,
+                           numProcesses, firstRow, lastRow);
+    const size_t ownBegin = rowOffsets[rank];
+    const size_t ownEnd = ownBegin + localRows;
+    std::vector<int> sendCounts(numProcesses), sendOffsets(numProcesses);
+    std::vector<int> recvCounts(numProcesses), recvOffsets(numProcesses);
+    for (int p = 0; p < numProcesses; p++) {
+        size_t first, last;
+        dataParallelPointRange(numRows, numCols, dataParallelClusters, p,
+                               numProcesses, first, last);
+        size_t begin = std::max(ownBegin, first);
+        size_t end = std::min(ownEnd, last);
+        sendCounts[p] = begin < end ? end - begin : 0;
+        sendOffsets[p] = begin < end ? begin - ownBegin : 0;
 
-        for (auto x : row)
-            allData.push_back(x);
+        begin = std::max<size_t>(rowOffsets[p], firstRow);
+        end = std::min<size_t>(rowOffsets[p] + rowCounts[p], lastRow);
+        recvCounts[p] = begin < end ? end - begin : 0;
+        recvOffsets[p] = begin < end ? begin - firstRow : 0;
+    }
+    allData.resize((lastRow - firstRow) * numCols);
+    MPI_Alltoallv(values.data(), sendCounts.data(), sendOffsets.data(), row,
+                  allData.data(), recvCounts.data(), recvOffsets.data(), row,
+                  MPI_COMM_WORLD);
+    MPI_Type_free(&row);
+    return true;
+}
+#endif
 
-        line++;
+// Helper function to read input file into allData, setting number of detected
+// rows and columns. The file is memory mapped and parsed on all cores; with
+// MPI, every process parses a part of it. 'allData' holds the rows from
+// 'firstRow' on, see readDataset.
+void readData(const std::string &fileName, bool useMPI,
+              int dataParallelClusters, std::vector<double> &allData,
+              size_t &numRows, size_t &numCols, size_t &firstRow) {
+#if KMEANS_WITH_MPI == 1
+    if (useMPI && readCSVPartitioned(fileName, dataParallelClusters, allData,
+                                     numRows, numCols, firstRow))
+        return;
+#endif
+    MappedCSVReader inReader(fileName);
+    inReader.read(allData, numRows, numCols);
+    firstRow = 0;
+}
+
+// Loads the dataset: binary dataset files are memory mapped and used in
+// place, CSV files are parsed. If 'useCache' is set, a parsed CSV file is
+// also stored as '<input>.bin', and later runs use that file instead, as long
+// as the size and modification time of the CSV file stay the same.
+void readDataset(const std::string &fileName, bool useCache, bool useMPI,
+                 Dataset &dataset, int dataParallelClusters) {
+    if (isBinaryDatasetFile(fileName)) {
+        if (!dataset.openBinary(fileName))
+            throw std::runtime_error("Invalid binary dataset " + fileName);
+        return;
     }
 
-    numRows = (size_t)allData.size() / numColsExpected;
-    numCols = (size_t)numColsExpected;
+    const std::string cacheFileName = fileName + ".bin";
+    FileStamp stamp;
+    useCache = useCache && getFileStamp(fileName, stamp);
+    if (useCache && isBinaryDatasetFile(cacheFileName) &&
+        dataset.openBinary(cacheFileName, &stamp))
+        return;
+
+    size_t numRows, numCols, firstRow;
+    std::vector<double> allData;
+    readData(fileName, useMPI, dataParallelClusters, allData, numRows,
+             numCols, firstRow);
+
+    // with MPI, one process writes the cache for all of them, if it has all
+    // the rows
+    bool writeCache = useCache && allData.size() == numRows * numCols;
+#if KMEANS_WITH_MPI == 1
+    if (useMPI) {
+        int rank;
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        writeCache = writeCache && rank == 0;
+    }
+#endif
+    if (writeCache) {
+        try {
+            writeBinaryDataset(cacheFileName, allData.data(), numRows,
+                               numCols, BinaryFloat64, 64, &stamp);
+        } catch (const std::exception &e) {
+            std::cerr << "WARNING: Unable to write dataset cache: " << e.what()
+                      << std::endl;
+        }
+    }
+    dataset.assign(std::move(allData), numRows, numCols, firstRow);
 }
 
 FileCSVWriter openDebugFile(const std::string &n) {
@@ -80,9 +463,109 @@ void printOutput(KMeansArgs args, KmeansOut output, Timer timer) {
               << "," << args.numClusters << "," << args.repetitions << ","
               << output.bestDistSquaredSum << ","
               << timer.durationNanoSeconds() / 1e9 << std::endl;
+
+    // how much work the engine saved, next to the header on std::cerr so the
+    // results on std::cout keep their format
+    const unsigned long long totalDistances =
+        output.distanceCalculations + output.skippedDistanceCalculations;
+    if (totalDistances > 0)
+        std::cerr << "# Distances: " << output.distanceCalculations
+                  << " calculated, " << output.skippedDistanceCalculations
+                  << " skipped ("
+                  << 100.0 * output.skippedDistanceCalculations / totalDistances
+                  << "%)" << std::endl;
+}
+
+// Whether this process was started by mpirun (Open MPI, MPICH, Intel MPI or
+// Slurm), without initializing MPI
+bool startedByMPI() {
+    return std::getenv("OMPI_COMM_WORLD_SIZE") || std::getenv("PMI_SIZE") ||
+           std::getenv("PMIX_RANK");
+}
+
+// The backend for KMeansBackend::Auto
+KMeansBackend chooseBackend() {
+    if (isBackendAvailable(KMeansBackend::MPI) && startedByMPI())
+        return KMeansBackend::MPI;
+    if (isBackendAvailable(KMeansBackend::OpenMP))
+        return KMeansBackend::OpenMP;
+    return KMeansBackend::Serial;
+}
+
+// Lets the auto-tuner choose the engine, the threads and the axis of the
+// backend, as far as the command line did not, or takes its earlier choice
+// for a problem of the same shape from the cache, if there is one. With MPI,
+// rank 0 chooses for all processes.
+void autoTune(KMeansArgs &args, KMeansBackend backend, const double *allData,
+              size_t numPoints, size_t pointSize,
+              const KMeansKernels &kernels) {
+    TuningProblem problem{numPoints, pointSize, args.numClusters,
+                          args.repetitions, backend, 1, availableCores()};
+    int rank = 0;
+#if KMEANS_WITH_MPI == 1
+    if (backend == KMeansBackend::MPI) {
+        MPI_Comm_size(MPI_COMM_WORLD, &problem.numProcesses);
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+        // the processes on this node share its cores
+        MPI_Comm node;
+        int processesPerNode;
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank,
+                            MPI_INFO_NULL, &node);
+        MPI_Comm_size(node, &processesPerNode);
+        MPI_Comm_free(&node);
+        problem.coresPerProcess = availableCores(processesPerNode);
+        MPI_Bcast(&problem.coresPerProcess, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    }
+#endif
+
+    const TuningFixed fixed =
+        fixedTuningChoice(problem, args.options, args.numThreads);
+    TuningChoice choice;
+    if (rank == 0) {
+        Timer timer;
+        // the cache has whole choices, for problems without fixed parts
+        const std::string &cacheFileName = args.options.tuningCacheFileName;
+        const bool useCache = !cacheFileName.empty() && !fixed.any();
+        const bool cached =
+            useCache && lookupTuningChoice(cacheFileName, problem, choice);
+        if (!cached) {
+            choice = calibrate(problem, allData, kernels, fixed);
+            if (useCache)
+                storeTuningChoice(cacheFileName, problem, choice);
+        }
+        timer.stop();
+        std::cerr << "# Auto-tuned: " << backendName(backend) << ", engine "
+                  << engineName(choice.engine) << ", " << choice.numThreads
+                  << " threads, split "
+                  << (choice.splitPoints ? "points" : "repetitions")
+                  << (cached ? " (cached)" : "") << ", "
+                  << timer.durationNanoSeconds() / 1e9 << " s" << std::endl;
+    }
+#if KMEANS_WITH_MPI == 1
+    if (backend == KMeansBackend::MPI) {
+        int values[3] = {(int)choice.engine, choice.numThreads,
+                         choice.splitPoints};
+        MPI_Bcast(values, 3, MPI_INT, 0, MPI_COMM_WORLD);
+        choice.engine = (KMeansEngine)values[0];
+        choice.numThreads = values[1];
+        choice.splitPoints = values[2] != 0;
+    }
+#endif
+    applyTuningChoice(problem, choice, fixed, args.options, args.numThreads);
 }
 
 int kmeans(KMeansArgs args) {
+    const KMeansBackend backend = args.options.backend == KMeansBackend::Auto
+                                      ? chooseBackend()
+                                      : args.options.backend;
+    if (!isBackendAvailable(backend)) {
+        std::cerr << "The " << backendName(backend)
+                  << " backend is not built into this executable" << std::endl;
+        return -1;
+    }
+    const bool useMPI = backend == KMeansBackend::MPI;
+
     // If debug filenames are specified, this opens them. The is_open method
     // can be used to check if they are actually open and should be written to.
     FileCSVWriter centroidDebugFile = openDebugFile(args.centroidDebugFileName);
@@ -95,70 +578,156 @@ int kmeans(KMeansArgs args) {
         return -1;
     }
 
-    // load dataset
-    size_t numPoints;
-    size_t pointSize;
-    std::vector<double> allData;
+    // the processes read the dataset together; in the hybrid build only the
+    // main thread of a process calls MPI
+    int rank = 0;
+    #if KMEANS_WITH_MPI == 1
+    if (useMPI) {
+        int argc = 0, threadSupport; char **argv = nullptr;
+        MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &threadSupport);
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    }
+    #endif
+
+    // load dataset; in the data-parallel MPI mode a process only keeps the
+    // points it works on, unless the auto-tuner picks the mode or the
+    // kd-tree, which sorts all points, is used
+    int dataParallelClusters = 0;
+    #if KMEANS_WITH_MPI == 1
+    if (useMPI && args.options.backend != KMeansBackend::Auto &&
+        args.options.engine != KMeansEngine::KdTree &&
+        usesDataParallelMPI(args.options, args.repetitions, args.numThreads))
+        dataParallelClusters = args.numClusters;
+    #endif
+    Dataset dataset;
+    readDataset(args.inputFileName, args.useDataCache, useMPI, dataset,
+                dataParallelClusters);
+    const size_t numPoints = dataset.numRows();
+    const size_t pointSize = dataset.numCols();
+    // the points keep their index in the whole dataset, only those in
+    // [firstPoint, lastPoint) are present
+    const size_t firstPoint = dataset.firstRow();
+    const size_t lastPoint = dataset.lastRow();
+    const double *allData = dataset.data() - firstPoint * pointSize;
+
+    // every initialisation needs k distinct points, all processes know n
+    if ((size_t)args.numClusters > numPoints) {
+        if (rank == 0)
+            std::cerr << "Requested more clusters (" << args.numClusters
+                      << ") than there are points (" << numPoints << ")"
+                      << std::endl;
+        #if KMEANS_WITH_MPI == 1
+        if (useMPI)
+            MPI_Finalize();
+        #endif
+        return -1;
+    }
+
+    // pick the kernels for this point size
+    const KMeansKernels kernels = selectKernels(pointSize);
 
-    std::ifstream inputFile;
-    inputFile.open(args.inputFileName);
-    readData(inputFile, allData, numPoints, pointSize);
-    inputFile.close();
+    if (args.options.backend == KMeansBackend::Auto)
+        autoTune(args, backend, allData, numPoints, pointSize, kernels);
+
+    // with OpenMP, pin the threads and spread the points over the NUMA
+    // nodes, instead of leaving them where they were read. Only the batched
+    // mode gives every thread fixed chunks, so that each chunk can be put on
+    // the node of its thread; otherwise every thread runs repetitions over
+    // all points, and the pages are interleaved over the nodes.
+    UninitializedVector<double> placedData;
+    if (backend == KMeansBackend::OpenMP) {
+        const NumaTopology topology;
+        pinThreads(topology, args.options.pinning, args.numThreads);
+
+        const bool batched = args.options.repetitionBatchSize > 1;
+        NumaPlacement placement = args.options.numaPlacement;
+        if (placement == NumaPlacement::Auto) {
+            if (topology.numNodes() > 1 && args.numThreads > 1)
+                placement = batched ? NumaPlacement::FirstTouch
+                                    : NumaPlacement::Interleave;
+            else
+                placement = NumaPlacement::None;
+        } else if (placement == NumaPlacement::FirstTouch && !batched) {
+            std::cerr << "WARNING: --numa firsttouch only places the points "
+                         "with --batch, leaving them where they were read"
+                      << std::endl;
+            placement = NumaPlacement::None;
+        }
+
+        if (placement == NumaPlacement::FirstTouch)
+            placedData = placePoints(allData, numPoints, pointSize,
+                                     args.numClusters, args.numThreads);
+        else if (placement == NumaPlacement::Interleave)
+            placedData = interleavePoints(topology, allData, numPoints,
+                                          pointSize, args.numThreads);
+        if (placement != NumaPlacement::None) {
+            allData = placedData.data();
+            dataset = Dataset();
+        }
+        std::cerr << "# " << topology.describe() << ", " << args.numThreads
+                  << " threads, pinning " << pinningName(args.options.pinning)
+                  << ", points "
+                  << (placement == NumaPlacement::FirstTouch
+                          ? "placed by first touch"
+                          : placement == NumaPlacement::Interleave
+                                ? "interleaved over the NUMA nodes"
+                                : "not placed")
+                  << std::endl;
+    }
 
     // start the timer
     Timer timer;
 
+    // anything the engine derives from the dataset, shared by all repetitions
+    const std::unique_ptr<const EngineData> engineData =
+        prepareEngineData(args.options, allData, numPoints, pointSize,
+                          firstPoint, lastPoint);
+
     // call the correct kmeans algorithm
+    KMeansIn input{args.repetitions, args.rng, args.numClusters,
+                   args.numBlocks, args.numThreads,
+                   numPoints, pointSize, allData, centroidDebugFile,
+                   clustersDebugFile, kernels, args.options,
+                   engineData.get()};
     KmeansOut output;
-    #if KMEANS_MODE_OPENMP == 1
-        output = kmeansOpenMP({args.repetitions, args.rng, args.numClusters,
-                               args.numBlocks, args.numThreads,
-                               numPoints, pointSize, allData, centroidDebugFile,
-                               clustersDebugFile});
-    #elif KMEANS_MODE_CUDA == 1
-        output = kmeansCUDA({args.repetitions, args.rng, args.numClusters,
-                            args.numBlocks, args.numThreads,
-                            numPoints, pointSize, allData, centroidDebugFile,
-                            clustersDebugFile});
-    #elif KMEANS_MODE_MPI == 1
-        int rank, totalUsedCores, totalCores, len;
-        char name[MPI_MAX_PROCESSOR_NAME+1];
-        int argc = 0; char **argv = nullptr;
-        MPI_Init(&argc, &argv);
+    switch (backend) {
+    case KMeansBackend::OpenMP:
+        output = kmeansOpenMP(input);
+        break;
+    #if KMEANS_MODE_CUDA == 1
+    case KMeansBackend::CUDA:
+        output = kmeansCUDA(input);
+        break;
+    #endif
+    #if KMEANS_WITH_MPI == 1
+    case KMeansBackend::MPI: {
+        int totalUsedCores, totalCores;
         totalUsedCores = args.numThreads;
         MPI_Comm_size(MPI_COMM_WORLD, &totalCores);
-        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-        MPI_Get_processor_name(name, &len);
-
-        output = kmeansMPI({args.repetitions, args.rng, args.numClusters,
-                            args.numBlocks, args.numThreads,
-                            numPoints, pointSize, allData, centroidDebugFile,
-                            clustersDebugFile}, rank, totalUsedCores, totalCores);
-    #else
-        output = kmeansSerial({args.repetitions, args.rng, args.numClusters,
-                               args.numBlocks, args.numThreads,
-                               numPoints, pointSize, allData, centroidDebugFile,
-                               clustersDebugFile});
+        output = kmeansMPI(input, rank, totalUsedCores, totalCores);
+        break;
+    }
     #endif
+    default:
+        output = kmeansSerial(input);
+    }
 
-    #if KMEANS_MODE_MPI == 1
     if (rank == 0){
-    #endif
-
-    timer.stop();
+        timer.stop();
 
-    // print the results to std::cout
-    printOutput(args, output, timer);
+        // print the results to std::cout
+        printOutput(args, output, timer);
 
-    // Write the number of steps per repetition, kind of a signature of the
-    // work involved
-    csvOutputFile.write(output.stepsPerRepetition, "# Steps: ");
-    // Write best clusters to csvOutputFile, something like
-    csvOutputFile.write(output.bestClusters);
-
-    #if KMEANS_MODE_MPI == 1
+        // Write the number of steps per repetition, kind of a signature of the
+        // work involved
+        csvOutputFile.write(output.stepsPerRepetition, "# Steps: ");
+        // Write best clusters to csvOutputFile, something like
+        csvOutputFile.write(output.bestClusters);
     }
-    MPI_Finalize();
+
+    #if KMEANS_WITH_MPI == 1
+    if (useMPI)
+        MPI_Finalize();
     #endif
     return 0;
-}
\ No newline at end of file
+}
@@ -3,29 +3,195 @@
 #include "rng.h"
 #include "CSVWriter.hpp"
 #include "types.h"
+#include "helper_functions.h"
+
+// The executables built for one backend (kmeans_serial, kmeans_openmp,
+// kmeans_mpi, kmeans_hybrid, kmeans_cuda) run that backend by default. The
+// 'kmeans' executable has the CPU backends, including MPI, and picks one at
+// run time (see --backend).
+#if KMEANS_MODE_MPI == 1 && !defined(KMEANS_WITH_MPI)
+#define KMEANS_WITH_MPI 1
+#endif
+
+// How the closest centroids are found in every step
+enum class KMeansEngine {
+    Lloyd, // compare every point with every centroid
+    Elkan,   // skip centroids using triangle inequality bounds
+    Hamerly, // skip points using one lower bound per point
+    Yinyang, // skip groups of centroids, for large numbers of clusters
+    KdTree,  // assign whole kd-tree nodes at once, for large, low-dimensional
+             // datasets
+    Gemm,    // distances of tiles of points as a matrix product, for wide
+             // points
+};
+
+// Parses an engine name as given on the command line ("lloyd", "elkan",
+// "hamerly", "yinyang", "kdtree", "gemm"), returns false if it is unknown
+bool parseEngineName(const std::string &name, KMeansEngine &engine);
+const char *engineName(KMeansEngine engine);
+
+// The implementation that runs the repetitions
+enum class KMeansBackend {
+    Auto,   // MPI when started by mpirun, otherwise OpenMP if available; the
+            // auto-tuner picks the engine, threads and axis (see autotune.h)
+    Serial,
+    OpenMP,
+    MPI,    // only in executables built with MPI
+    CUDA,   // only in kmeans_cuda
+};
+
+// Parses a backend name as given on the command line ("auto", "serial",
+// "openmp", "mpi", "cuda"), returns false if it is unknown
+bool parseBackendName(const std::string &name, KMeansBackend &backend);
+const char *backendName(KMeansBackend backend);
+
+// The backend this executable was built for, Auto for 'kmeans'
+KMeansBackend defaultBackend();
+
+// Whether this executable contains the backend
+bool isBackendAvailable(KMeansBackend backend);
+
+// How the initial centroids of a repetition are chosen
+enum class KMeansInit {
+    Random,         // k distinct points of the dataset
+    KMeansPlusPlus, // k-means++: points far from the chosen ones are likelier
+    KMeansParallel, // k-means||: k-means++ in a few rounds of many points
+};
+
+// Parses an initialisation name as given on the command line ("random",
+// "kmeans++", "kmeans-parallel"), returns false if it is unknown
+bool parseInitName(const std::string &name, KMeansInit &init);
+
+// How the MPI backend divides the work over the processes
+enum class MPIMode {
+    Auto,        // Repetitions if there are enough of them for all processes,
+                 // otherwise Data
+    Repetitions, // every process runs some repetitions on all points
+    Data,        // all processes run every repetition, each on some points
+};
+
+// Parses an MPI mode as given on the command line ("auto", "repetitions",
+// "data"), returns false if it is unknown
+bool parseMPIModeName(const std::string &name, MPIMode &mode);
+
+// How the OpenMP backend pins its threads to the CPUs (see numa.h)
+enum class ThreadPinning {
+    None,    // leave it to the operating system
+    Compact, // fill the CPUs of the first NUMA node, then the next one, ...
+    Scatter, // take the NUMA nodes in turn
+};
+
+// Parses a pinning as given on the command line ("none", "compact",
+// "scatter"), returns false if it is unknown
+bool parsePinningName(const std::string &name, ThreadPinning &pinning);
+const char *pinningName(ThreadPinning pinning);
+
+// Where the OpenMP backend puts the points (see placePoints and
+// interleavePoints)
+enum class NumaPlacement {
+    Auto,       // with several NUMA nodes and threads, FirstTouch in the
+                // batched mode (see repetitionBatchSize) and Interleave
+                // otherwise, else None
+    FirstTouch, // a copy written by the threads that process each chunk,
+                // only in the batched mode
+    Interleave, // a copy with its pages spread over the nodes in turn
+    None,       // where they were read
+};
+
+// Parses a placement as given on the command line ("auto", "firsttouch",
+// "interleave", "none"), returns false if it is unknown
+bool parseNumaPlacementName(const std::string &name, NumaPlacement &placement);
+
+// Options that select between variants of the algorithm. The defaults give
+// the reference results.
+struct KMeansOptions {
+    KMeansBackend backend = defaultBackend();
+
+    // All engines give the same clusters and numbers of steps, except for
+    // rounding differences with KMeansEngine::KdTree
+    KMeansEngine engine = KMeansEngine::Lloyd;
+
+    KMeansInit init = KMeansInit::Random;
+
+    // 0: every step recomputes the centroids from all points. N > 0: the
+    // per-cluster sums are kept between steps and only the points that
+    // changed cluster are applied, with a full recompute every N steps to
+    // limit the floating point drift.
+    int incrementalUpdateInterval = 0;
+
+    // OpenMP backend: if > 1, this many repetitions run in lockstep, so every
+    // pass over the dataset serves all of them (see kmeansOpenMPBatch)
+    int repetitionBatchSize = 0;
+
+    // MPI backend: all modes give the same results
+    MPIMode mpiMode = MPIMode::Auto;
+
+    // MPI repetition mode: hand out the repetitions one at a time to the
+    // processes that are done with their last one, instead of fixed blocks;
+    // falls back to the blocks where MPI windows are not supported
+    bool dynamicMPISchedule = false;
+
+    // MPI backend built with OpenMP (kmeans_hybrid): the threads every
+    // process uses for its repetitions or its part of the points
+    int threadsPerRank = 1;
+
+    // OpenMP backend: the placement of the threads and the points on NUMA
+    // machines, which does not change the results
+    ThreadPinning pinning = ThreadPinning::None;
+    NumaPlacement numaPlacement = NumaPlacement::Auto;
+
+    // KMeansBackend::Auto: the file in which the auto-tuner keeps its
+    // choices, per shape of the problem; none if empty
+    std::string tuningCacheFileName;
+
+    // KMeansBackend::Auto: the settings given on the command line, which the
+    // auto-tuner keeps instead of choosing them
+    bool engineGiven = false;         // --engine
+    bool threadsGiven = false;        // --threads
+    bool batchGiven = false;          // --batch
+    bool mpiModeGiven = false;        // --mpimode
+    bool threadsPerRankGiven = false; // --threadsperrank
+};
 
 struct KMeansArgs {
     KMeansArgs(Rng &rng, const std::string &inputFileName,
                const std::string &outputFileName, int numClusters,
                int repetitions, int numBlocks, int numThreads,
                const std::string &centroidDebugFileName = "",
-               const std::string &clusterDebugFileName = "");
+               const std::string &clusterDebugFileName = "",
+               bool useDataCache = false,
+               const KMeansOptions &options = KMeansOptions());
 
     Rng &rng;
-    const std::string &inputFileName;
-    const std::string &outputFileName;
+    std::string inputFileName;
+    std::string outputFileName;
     int numClusters;
     int repetitions;
     int numBlocks;
     int numThreads;
 
     // optional
-    const std::string &centroidDebugFileName;
-    const std::string &clusterDebugFileName;
+    std::string centroidDebugFileName;
+    std::string clusterDebugFileName;
+    bool useDataCache;
+    KMeansOptions options;
 };
 
 int kmeans(KMeansArgs args);
 
+class Dataset;
+
+// Loads a CSV or binary dataset file (see --input and --cache). With
+// 'useMPI', all processes call this together. If 'dataParallelClusters' is
+// set as well, a process only keeps the points of dataParallelPointRange for
+// that many clusters, from dataset.firstRow() on (a binary dataset file is
+// mapped as a whole).
+void readDataset(const std::string &fileName, bool useCache, bool useMPI,
+                 Dataset &dataset, int dataParallelClusters = 0);
+
+class EngineData;
+class LloydStepPool;
+
 struct KMeansIn{
     int repetitions;
     Rng& rng;
@@ -34,18 +200,45 @@ struct KMeansIn{
     int numThreads;
     size_t numPoints;
     size_t pointSize;
-    std::vector<double> allData;
+    const double *allData; // numPoints x pointSize, row-major
     FileCSVWriter& centroidDebugFile;
     FileCSVWriter& clustersDebugFile;
+    KMeansKernels kernels;
+    KMeansOptions options;
+    const EngineData *engineData; // see prepareEngineData, may be nullptr
+
+    // Serial and OpenMP: the steps to reuse, which outlive the call (see
+    // KMeansSession); nullptr to keep them for this call only
+    LloydStepPool *stepPool = nullptr;
 };
 struct KmeansOut
 {
     double bestDistSquaredSum;
     std::vector<int> bestClusters;
     std::vector<int> stepsPerRepetition;
+
+    // kmeansSerial and kmeansOpenMP: the centroids the step of bestClusters
+    // left (at the origin for clusters without points)
+    CentroidMatrix bestCentroids;
+
+    // point to centroid distances calculated and skipped by the engine, over
+    // all repetitions (0 if the backend does not count them)
+    unsigned long long distanceCalculations = 0;
+    unsigned long long skippedDistanceCalculations = 0;
 };
 
 KmeansOut kmeansSerial(KMeansIn input);
 KmeansOut kmeansOpenMP(KMeansIn input);
 KmeansOut kmeansCUDA(KMeansIn input);
-KmeansOut kmeansMPI(KMeansIn input, int rank, int totalUsedCores, int totalCores);
\ No newline at end of file
+KmeansOut kmeansMPI(KMeansIn input, int rank, int totalUsedCores, int totalCores);
+
+// Whether kmeansMPI runs every repetition on all processes together, each on
+// its own share of the points (MPIMode::Data), for these options
+bool usesDataParallelMPI(const KMeansOptions &options, int repetitions,
+                         int totalUsedCores);
+
+// The points [first, last) a process reads in the data-parallel mode: those
+// it assigns in every step, and those it uses to choose initial centroids
+void dataParallelPointRange(size_t numPoints, size_t pointSize,
+                            int numClusters, int rank, int numProcesses,
+                            size_t &first, size_t &last);
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "helper_functions.h"
 #include "kmeans.h"
+#include "seeding.h"
 #include <iostream>
 #include <string.h>
 #include <thrust/reduce.h>
@@ -7,7 +8,7 @@
 struct KMeansItInput {
     const size_t numPoints;
     const size_t pointSize;
-    const std::vector<double> &allData;
+    const double *allData;
     std::vector<double> &centroids;
     const int numClusters;
     FileCSVWriter &centroidDebugFile;
@@ -150,7 +151,7 @@ int kmeansCUDAIteration(KMeansItOutput &out, KMeansItInput &in,
 
         if (changed) {  // re-calculate the centroids based on current clustering
             moveCentroidsToAverage((size_t)in.numPoints, (size_t)in.pointSize, (size_t)in.numClusters,
-                                            (double*)in.centroids.data(), (int*)out.clusters.data(), (double*)in.allData.data());
+                                            (double*)in.centroids.data(), (int*)out.clusters.data(), (double*)in.allData);
         }
 
         double dist = thrust::reduce(distSquaredSum.begin(), distSquaredSum.end());
@@ -178,16 +179,15 @@ KmeansOut kmeansCUDA(KMeansIn input) {
 
     // Run seeded generator serial on CPU so reps has same start-centroids every time
     // (in case repetitions are run parallel)
-    std::vector<std::vector<Point>> centroids_per_repetition(input.repetitions, std::vector<Point>(input.numClusters));
+    CentroidMatrix centroids(input.numClusters, input.pointSize);
     std::vector<std::vector<double>> flat_centroids_per_repetition(input.repetitions);
     for (size_t r = 0; r < input.repetitions; r++) {
-        chooseCentroidsAtRandomFromDataset(input.rng, input.numPoints,
-                                            input.pointSize, input.allData,
-                                            centroids_per_repetition[r]);
-        // Flatten centroids array
-        for (Point point: centroids_per_repetition[r])
-            for (double i: point)
-                flat_centroids_per_repetition[r].push_back(i);
+        chooseInitialCentroids(input.options, input.rng, r, input.kernels,
+                               input.allData, input.numPoints,
+                               input.pointSize, 1, centroids);
+        // The centroid rows are already stored flat
+        flat_centroids_per_repetition[r].assign(centroids.data(),
+            centroids.data() + input.numClusters * input.pointSize);
     }
 
     // Init array-pointers for copying to GPU
@@ -205,14 +205,14 @@ KmeansOut kmeansCUDA(KMeansIn input) {
     std::vector<int> startClusters(input.numPoints, -1);
 
     // Allocate memory for GPU (reuse for every rep)
-    cudaMalloc(&cuAllData, input.allData.size()*sizeof(double));
+    cudaMalloc(&cuAllData, input.numPoints*input.pointSize*sizeof(double));
     cudaMalloc(&cuCentroids, input.numClusters*input.pointSize*sizeof(double));
     cudaMalloc(&cuClusters, startClusters.size()*sizeof(int));
     cudaMalloc(&cuDistSquaredSum, distSquaredSum.size()*sizeof(double));
     cudaMalloc(&cuChanged, sizeof(bool));
 
     // Copy usable information for all repetition to GPU
-    cudaMemcpy(cuAllData, input.allData.data(), input.allData.size()*sizeof(double), cudaMemcpyHostToDevice);
+    cudaMemcpy(cuAllData, input.allData, input.numPoints*input.pointSize*sizeof(double), cudaMemcpyHostToDevice);
 
     // Do the k-means routine a number of times, each time starting from
     // different random centroids (use Rng::pickRandomIndices), and keep
@@ -1,20 +1,27 @@
-#if KMEANS_MODE_MPI == 1
+#if KMEANS_MODE_MPI == 1 || KMEANS_WITH_MPI == 1
 #include "helper_functions.h"
 #include "kmeans.h"
+#include "lloyd_step.h"
+#include "seeding.h"
 #include <iostream>
 #include <algorithm>
+#include <cstdint>
+#include <limits>
 #include <mpi.h>
 #include <stdio.h>
 
 struct KMeansItInput {
     const size_t numPoints;
     const size_t pointSize;
-    const std::vector<double> &allData;
-    std::vector<Point> &centroids;
+    const double *allData;
+    CentroidMatrix &centroids;
     std::vector<int>& pointCounts;
     const int numClusters;
     FileCSVWriter &centroidDebugFile;
     FileCSVWriter &clustersDebugFile;
+    const KMeansKernels &kernels;
+    const KMeansOptions &options;
+    const EngineData *engineData;
     int numThreads;
 };
 
@@ -23,20 +30,161 @@ struct KMeansItOutput {
     std::vector<int> bestClusters;
     double bestDistSquaredSum;
     std::vector<int> clusters;
+    unsigned long long distanceCalculations = 0;
+    unsigned long long skippedDistanceCalculations = 0;
 };
 
-/* Only execute by rank 0 */
-void getBestCluster(int srcRank, int numPoints, std::vector<int> &outBestCluster) {
-    std::vector<int> bestCluster(numPoints);
+// Shares the passes over the dataset of k-means|| between all processes
+class MPISeedingComm : public SeedingComm {
+  public:
+    MPISeedingComm(int rank, int numProcesses)
+        : SeedingComm(rank, numProcesses) {}
 
-    // Broadcast sending rank
-    MPI_Bcast(&srcRank, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    void sum(std::vector<double> &values) const override {
+        MPI_Allreduce(MPI_IN_PLACE, values.data(), values.size(), MPI_DOUBLE,
+                      MPI_SUM, MPI_COMM_WORLD);
+    }
+
+    // every process contributes the points of its blocks
+    void copyPoints(const double *allData, size_t numPoints, size_t pointSize,
+                    const std::vector<size_t> &indices,
+                    double *to) const override {
+        std::vector<int> owners(indices.size());
+        std::vector<int> counts(numProcesses(), 0), offsets(numProcesses(), 0);
+        for (size_t j = 0; j < indices.size(); j++) {
+            owners[j] = pointOwner(numPoints, indices[j]);
+            counts[owners[j]] += pointSize;
+        }
+        for (int p = 1; p < numProcesses(); p++)
+            offsets[p] = offsets[p - 1] + counts[p - 1];
+
+        std::vector<double> own;
+        own.reserve(counts[rank()]);
+        for (size_t j = 0; j < indices.size(); j++)
+            if (owners[j] == rank())
+                own.insert(own.end(), allData + indices[j] * pointSize,
+                           allData + (indices[j] + 1) * pointSize);
+        std::vector<double> all(indices.size() * pointSize);
+        MPI_Allgatherv(own.data(), counts[rank()], MPI_DOUBLE, all.data(),
+                       counts.data(), offsets.data(), MPI_DOUBLE,
+                       MPI_COMM_WORLD);
+
+        // back in the order of the indices
+        for (size_t j = 0; j < indices.size(); j++) {
+            const double *point = all.data() + offsets[owners[j]];
+            to = std::copy(point, point + pointSize, to);
+            offsets[owners[j]] += pointSize;
+        }
+    }
+};
+
+// Hands out repetition indices from a counter in a window on rank 0, which
+// the processes increment with an atomic MPI_Fetch_and_op; rank 0 does not
+// need to take part to serve them, so it runs repetitions as well.
+//
+// Not every MPI setup supports windows (e.g. Open MPI over plain TCP), so
+// creating it may fail; all processes then see isAvailable() false. A window
+// that only some processes managed to create is left alone, freeing it
+// would wait for the others.
+class RepetitionCounter {
+  public:
+    RepetitionCounter(int rank) {
+        MPI_Errhandler errorHandler;
+        MPI_Comm_get_errhandler(MPI_COMM_WORLD, &errorHandler);
+        MPI_Comm_set_errhandler(MPI_COMM_WORLD, MPI_ERRORS_RETURN);
+        const int created =
+            MPI_Win_create(&m_next, rank == 0 ? sizeof(m_next) : 0,
+                           sizeof(m_next), MPI_INFO_NULL, MPI_COMM_WORLD,
+                           &m_window) == MPI_SUCCESS;
+        MPI_Comm_set_errhandler(MPI_COMM_WORLD, errorHandler);
+        MPI_Errhandler_free(&errorHandler);
+
+        int createdEverywhere = created;
+        MPI_Allreduce(MPI_IN_PLACE, &createdEverywhere, 1, MPI_INT, MPI_MIN,
+                      MPI_COMM_WORLD);
+        m_available = createdEverywhere != 0;
+        if (m_available)
+            MPI_Win_lock_all(0, m_window);
+    }
+    ~RepetitionCounter() {
+        if (!m_available)
+            return;
+        MPI_Win_unlock_all(m_window);
+        MPI_Win_free(&m_window);
+    }
+
+    bool isAvailable() const { return m_available; }
+
+    unsigned long long next() {
+        const unsigned long long one = 1;
+        unsigned long long index;
+        MPI_Fetch_and_op(&one, &index, MPI_UNSIGNED_LONG_LONG, 0, 0, MPI_SUM,
+                         m_window);
+        MPI_Win_flush(0, m_window);
+        return index;
+    }
+
+  private:
+    unsigned long long m_next = 0;
+    MPI_Win m_window;
+    bool m_available;
+};
 
-    // If best cluster not in process 0, recv if from the process that has it
-    if (srcRank != 0) {
-        int tag = 0;
-        MPI_Status status;
-        MPI_Recv(&outBestCluster, numPoints, MPI_INT, srcRank, tag, MPI_COMM_WORLD, &status);
+// The cluster indices are sent in the narrowest unsigned type that holds
+// all of them, with the largest value of the type standing for 'unknown'(-1)
+template <typename T>
+void packLabels(const std::vector<int> &clusters, std::vector<char> &buffer) {
+    buffer.resize(clusters.size() * sizeof(T));
+    T *labels = reinterpret_cast<T *>(buffer.data());
+    for (size_t i = 0; i < clusters.size(); i++)
+        labels[i] = clusters[i] < 0 ? std::numeric_limits<T>::max()
+                                    : static_cast<T>(clusters[i]);
+}
+
+template <typename T>
+void unpackLabels(const std::vector<char> &buffer, std::vector<int> &clusters) {
+    const T *labels = reinterpret_cast<const T *>(buffer.data());
+    for (size_t i = 0; i < clusters.size(); i++)
+        clusters[i] = labels[i] == std::numeric_limits<T>::max() ? -1 : labels[i];
+}
+
+// bytes per cluster index for k clusters
+size_t labelWidth(int numClusters) {
+    if (numClusters < std::numeric_limits<uint8_t>::max())
+        return sizeof(uint8_t);
+    if (numClusters < std::numeric_limits<uint16_t>::max())
+        return sizeof(uint16_t);
+    return sizeof(int);
+}
+
+void packLabels(const std::vector<int> &clusters, int numClusters,
+                std::vector<char> &buffer) {
+    switch (labelWidth(numClusters)) {
+    case sizeof(uint8_t):
+        packLabels<uint8_t>(clusters, buffer);
+        break;
+    case sizeof(uint16_t):
+        packLabels<uint16_t>(clusters, buffer);
+        break;
+    default:
+        buffer.resize(clusters.size() * sizeof(int));
+        std::copy(clusters.begin(), clusters.end(),
+                  reinterpret_cast<int *>(buffer.data()));
+    }
+}
+
+void unpackLabels(const std::vector<char> &buffer, int numClusters,
+                  std::vector<int> &clusters) {
+    switch (labelWidth(numClusters)) {
+    case sizeof(uint8_t):
+        unpackLabels<uint8_t>(buffer, clusters);
+        break;
+    case sizeof(uint16_t):
+        unpackLabels<uint16_t>(buffer, clusters);
+        break;
+    default:
+        const int *labels = reinterpret_cast<const int *>(buffer.data());
+        std::copy(labels, labels + clusters.size(), clusters.begin());
     }
 }
 
@@ -44,35 +192,29 @@ int kmeansMPIIteration(KMeansItOutput &out, KMeansItInput &in) {
 
     bool changed = true;
     out.numSteps = 0;
+    std::unique_ptr<LloydStep> step =
+        createLloydStep(in.options, in.engineData, in.numPoints,
+                        in.numClusters, in.pointSize);
 
     // write starting step clusters and centroids to the debug files if open
     if (in.centroidDebugFile.is_open())
-        in.centroidDebugFile.write(in.centroids);
+        in.centroidDebugFile.write(in.centroids.data(),
+                                   in.centroids.numCentroids(), in.pointSize);
     if (in.clustersDebugFile.is_open())
         in.clustersDebugFile.write(out.clusters);
 
     while (changed) {
-        changed = false;
-        double distSquaredSum = 0;
+        double distSquaredSum;
+        in.centroids.updateBlocked();
 
-        for (size_t pointIndex = 0; pointIndex < in.numPoints; pointIndex++) {
-            int newCluster;
-            double dist;
+        // assign the points and sum them per cluster in one pass
+        #pragma omp parallel for schedule(static) num_threads(in.options.threadsPerRank)
+        for (size_t chunk = 0; chunk < step->numChunks(); chunk++)
+            step->processChunk(chunk, in.kernels, in.allData, in.centroids,
+                               out.clusters.data());
 
-            findClosestCentroidIndexAndDistance(pointIndex, in.pointSize,
-                                                in.allData, in.centroids,
-                                                newCluster, dist);
-
-            distSquaredSum += dist;
-
-            if (newCluster != out.clusters[pointIndex]) {
-                out.clusters[pointIndex] = newCluster;
-                changed = true;
-            }
-        }
-        if (changed) // re-calculate the centroids based on current clustering
-            moveCentroidsToAverage(in.centroids, out.clusters, in.numPoints,
-                                   in.pointSize, in.allData, in.pointCounts);
+        // re-calculate the centroids based on current clustering
+        changed = step->finish(in.centroids, in.pointCounts, distSquaredSum);
 
         // Keep track of best clustering
         if (distSquaredSum < out.bestDistSquaredSum) {
@@ -83,15 +225,197 @@ int kmeansMPIIteration(KMeansItOutput &out, KMeansItInput &in) {
 
         // write the step to the debug files if open
         if (in.centroidDebugFile.is_open())
-            in.centroidDebugFile.write(in.centroids);
+            in.centroidDebugFile.write(in.centroids.data(),
+                                       in.centroids.numCentroids(), in.pointSize);
         if (in.clustersDebugFile.is_open())
             in.clustersDebugFile.write(out.clusters);
     }
 
+    out.distanceCalculations += step->distanceCalculations();
+    out.skippedDistanceCalculations += step->skippedDistanceCalculations();
+    return 0;
+}
+
+// Combines the clusters of all processes on rank 0; each process has set
+// those of its own points, the others are -1
+void gatherClusters(std::vector<int> &clusters, int rank) {
+    if (rank == 0)
+        MPI_Reduce(MPI_IN_PLACE, clusters.data(), clusters.size(), MPI_INT,
+                   MPI_MAX, 0, MPI_COMM_WORLD);
+    else
+        MPI_Reduce(clusters.data(), nullptr, clusters.size(), MPI_INT,
+                   MPI_MAX, 0, MPI_COMM_WORLD);
+}
+
+// Data-parallel iteration: every process assigns the points of its share of
+// the chunks, then the partial results of all chunks are exchanged, so that
+// all processes compute the same centroids. The clusters in 'out' are
+// those of the own points, the others are -1.
+int kmeansMPIDataIteration(KMeansItOutput &out, KMeansItInput &in, int rank,
+                           int totalCores) {
+
+    bool changed = true;
+    out.numSteps = 0;
+    std::unique_ptr<LloydStep> step =
+        createLloydStep(in.options, in.engineData, in.numPoints,
+                        in.numClusters, in.pointSize);
+
+    const size_t numChunks = step->numChunks();
+    const size_t firstChunk = numChunks * rank / totalCores;
+    const size_t lastChunk = numChunks * (rank + 1) / totalCores;
+    std::vector<double> partials;
+    std::vector<int> ownClusters;
+
+    // write starting step clusters and centroids to the debug files if open
+    const bool debugClusters = in.clustersDebugFile.is_open();
+    if (rank == 0 && in.centroidDebugFile.is_open())
+        in.centroidDebugFile.write(in.centroids.data(),
+                                   in.centroids.numCentroids(), in.pointSize);
+    if (rank == 0 && debugClusters)
+        in.clustersDebugFile.write(out.clusters);
+
+    while (changed) {
+        double distSquaredSum;
+        in.centroids.updateBlocked();
+
+        // assign the own points and sum them per cluster in one pass
+        #pragma omp parallel for schedule(static) num_threads(in.options.threadsPerRank)
+        for (size_t chunk = firstChunk; chunk < lastChunk; chunk++)
+            step->processChunk(chunk, in.kernels, in.allData, in.centroids,
+                               out.clusters.data());
+
+        // give every process the partial results of all chunks
+        step->packChunks(firstChunk, lastChunk, partials);
+        MPI_Allreduce(MPI_IN_PLACE, partials.data(), partials.size(),
+                      MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        step->unpackChunks(partials);
+
+        // re-calculate the centroids based on current clustering
+        changed = step->finish(in.centroids, in.pointCounts, distSquaredSum);
+
+        // Keep track of best clustering
+        if (distSquaredSum < out.bestDistSquaredSum) {
+            out.bestClusters = out.clusters;
+            out.bestDistSquaredSum = distSquaredSum;
+        }
+        ++out.numSteps;
+
+        // keep only the clusters of the own points after the last step, or
+        // after every step to write them to the debug file
+        if (!changed || debugClusters) {
+            ownClusters.assign(in.numPoints, -1);
+            step->copyChunkClusters(firstChunk, lastChunk, out.clusters,
+                                    ownClusters);
+        }
+        if (!changed)
+            out.clusters = ownClusters;
+
+        // write the step to the debug files if open
+        if (rank == 0 && in.centroidDebugFile.is_open())
+            in.centroidDebugFile.write(in.centroids.data(),
+                                       in.centroids.numCentroids(), in.pointSize);
+        if (debugClusters) {
+            gatherClusters(ownClusters, rank);
+            if (rank == 0)
+                in.clustersDebugFile.write(ownClusters);
+        }
+    }
+
+    // every process has counted the distances of all chunks
+    out.distanceCalculations += step->distanceCalculations();
+    out.skippedDistanceCalculations += step->skippedDistanceCalculations();
     return 0;
 }
 
+// Data-parallel mode: all processes run every repetition together
+KmeansOut kmeansMPIData(KMeansIn input, int rank, int totalCores) {
+    KmeansOut out;
+    out.stepsPerRepetition.resize(input.repetitions, 0);
+    out.bestDistSquaredSum = std::numeric_limits<double>::max();
+    out.bestClusters = std::vector<int>(input.numPoints, -1);
+    size_t it_of_best_cluster = 0;
+
+    const MPISeedingComm seedingComm(rank, totalCores);
+    CentroidMatrix centroids(input.numClusters, input.pointSize);
+    std::vector<int> pointCounts(input.numClusters);
+
+    for (size_t r = 0; r < input.repetitions; r++) {
+        chooseInitialCentroids(input.options, input.rng, r, input.kernels,
+                               input.allData, input.numPoints,
+                               input.pointSize, input.options.threadsPerRank, centroids,
+                               seedingComm);
+
+        // Create the iteration parameters
+        KMeansItInput itinput{input.numPoints,        input.pointSize,
+                            input.allData,          centroids, pointCounts,
+                            input.numClusters,      input.centroidDebugFile,
+                            input.clustersDebugFile, input.kernels, input.options, input.engineData, input.numThreads};
+
+        // create iteration output struct
+        KMeansItOutput itoutput;
+        itoutput.bestDistSquaredSum = std::numeric_limits<double>::max();
+        // Init closest centroid index for every point: 'unknown'(-1)
+        itoutput.clusters = std::vector<int>(input.numPoints, -1);
+        itoutput.numSteps = 0;
+
+        // start iteration
+        kmeansMPIDataIteration(itoutput, itinput, rank, totalCores);
+
+        // all processes have the same sums, so they all keep the same
+        // repetition, each with the clusters of its own points
+        out.stepsPerRepetition[r] = itoutput.numSteps;
+        out.distanceCalculations += itoutput.distanceCalculations;
+        out.skippedDistanceCalculations += itoutput.skippedDistanceCalculations;
+
+        if (itoutput.bestDistSquaredSum <= out.bestDistSquaredSum) {
+            // take the best clusters from te lowest repetition
+            if (itoutput.bestDistSquaredSum != out.bestDistSquaredSum || r < it_of_best_cluster){
+                out.bestClusters = itoutput.clusters;
+                out.bestDistSquaredSum = itoutput.bestDistSquaredSum;
+                it_of_best_cluster = r;
+            }
+        }
+    }
+
+    gatherClusters(out.bestClusters, rank);
+    return out;
+}
+
+// Data-parallel when asked for, or when the repetitions would leave
+// processes idle
+bool usesDataParallelMPI(const KMeansOptions &options, int repetitions,
+                         int totalUsedCores) {
+    return options.mpiMode == MPIMode::Data ||
+           (options.mpiMode == MPIMode::Auto && repetitions < totalUsedCores);
+}
+
+void dataParallelPointRange(size_t numPoints, size_t pointSize,
+                            int numClusters, int rank, int numProcesses,
+                            size_t &first, size_t &last) {
+    // the points of the own chunks, see kmeansMPIDataIteration
+    size_t numChunks, chunkSize;
+    LloydStep::chunkLayout(numPoints, numClusters, pointSize, numChunks,
+                           chunkSize);
+    first = std::min(numChunks * rank / numProcesses * chunkSize, numPoints);
+    last = std::min(numChunks * (rank + 1) / numProcesses * chunkSize,
+                    numPoints);
+
+    // and those of the own seeding blocks
+    size_t seedingFirst, seedingLast;
+    SeedingComm(rank, numProcesses).pointRange(numPoints, seedingFirst,
+                                               seedingLast);
+    if (first == last) {
+        first = seedingFirst;
+        last = seedingLast;
+    } else if (seedingFirst < seedingLast) {
+        first = std::min(first, seedingFirst);
+        last = std::max(last, seedingLast);
+    }
+}
+
 KmeansOut kmeansMPI(KMeansIn input, int rank, int totalUsedCores, int totalCores) {
+    if (usesDataParallelMPI(input.options, input.repetitions, totalUsedCores))
+        return kmeansMPIData(input, rank, totalCores);
 
     // Divide repetitions over all cores (of all nodes) -> each core having 1 thread running
     int repsPerNode = input.repetitions / totalUsedCores;
@@ -106,7 +430,23 @@ KmeansOut kmeansMPI(KMeansIn input, int rank, int totalUsedCores, int totalCores
          end_index = std::min(input.repetitions, (int)start_index + repsPerNode + (rank < extraReps? 1 : 0));
     }
 
-    printf("Hello %d/%d, reps %d-%d\n", rank, totalUsedCores, start_index, end_index);
+    // a single process has nobody to share the repetitions with
+    std::unique_ptr<RepetitionCounter> counter;
+    if (input.options.dynamicMPISchedule && totalCores > 1) {
+        counter.reset(new RepetitionCounter(rank));
+        if (!counter->isAvailable()) {
+            counter.reset();
+            if (rank == 0)
+                std::cerr << "# MPI windows are not supported here, using "
+                             "the static schedule"
+                          << std::endl;
+        }
+    }
+    const bool dynamic = counter != nullptr;
+    if (dynamic)
+        printf("Hello %d/%d, reps on demand\n", rank, totalUsedCores);
+    else
+        printf("Hello %d/%d, reps %d-%d\n", rank, totalUsedCores, start_index, end_index);
 
     KmeansOut out;
 
@@ -114,15 +454,29 @@ KmeansOut kmeansMPI(KMeansIn input, int rank, int totalUsedCores, int totalCores
     out.bestDistSquaredSum = std::numeric_limits<double>::max();
     out.bestClusters = std::vector<int>(input.numPoints, -1);
     size_t it_of_best_cluster = 0;
-    std::vector<std::vector<Point>> centroids_per_repetition(input.repetitions, std::vector<Point>(input.numClusters));
+    std::vector<CentroidMatrix> centroids_per_repetition(input.repetitions, CentroidMatrix(input.numClusters, input.pointSize));
     
-    for (size_t r = 0; r < input.repetitions; r++) {
-        chooseCentroidsAtRandomFromDataset(input.rng, input.numPoints,
-                                                input.pointSize, input.allData,
-                                                centroids_per_repetition[r]);
-    }
-
-    for (size_t r = start_index; r < end_index; r++) {
+    // The legacy generator needs all repetitions to pick in order, and
+    // k-means|| runs on all processes together; otherwise a process only
+    // picks the centroids of its own repetitions, when it starts them
+    const MPISeedingComm seedingComm(rank, totalCores);
+    const SeedingComm ownSeeding;
+    const bool pickOwnOnly =
+        canChooseCentroidsIndependently(input.options, input.rng);
+    auto chooseCentroids = [&](size_t r) {
+        chooseInitialCentroids(input.options, input.rng, r, input.kernels,
+                               input.allData, input.numPoints,
+                               input.pointSize, input.options.threadsPerRank,
+                               centroids_per_repetition[r],
+                               pickOwnOnly ? ownSeeding : seedingComm);
+    };
+    if (!pickOwnOnly)
+        for (size_t r = 0; r < input.repetitions; r++)
+            chooseCentroids(r);
+
+    auto runRepetition = [&](size_t r) {
+        if (pickOwnOnly)
+            chooseCentroids(r);
 
         std::vector<int> pointCounts;
         pointCounts.resize(input.numClusters);
@@ -131,7 +485,7 @@ KmeansOut kmeansMPI(KMeansIn input, int rank, int totalUsedCores, int totalCores
         KMeansItInput itinput{input.numPoints,        input.pointSize,
                             input.allData,          centroids_per_repetition[r], pointCounts,
                             input.numClusters,      input.centroidDebugFile,
-                            input.clustersDebugFile, input.numThreads};
+                            input.clustersDebugFile, input.kernels, input.options, input.engineData, input.numThreads};
 
         // create iteration output struct
         KMeansItOutput itoutput;
@@ -145,6 +499,8 @@ KmeansOut kmeansMPI(KMeansIn input, int rank, int totalUsedCores, int totalCores
 
         // update num of steps for this iteration
         out.stepsPerRepetition[r] = itoutput.numSteps;
+        out.distanceCalculations += itoutput.distanceCalculations;
+        out.skippedDistanceCalculations += itoutput.skippedDistanceCalculations;
 
         if (itoutput.bestDistSquaredSum <= out.bestDistSquaredSum) {
             // take the best clusters from te lowest repetition
@@ -154,62 +510,81 @@ KmeansOut kmeansMPI(KMeansIn input, int rank, int totalUsedCores, int totalCores
                 it_of_best_cluster = r;
             }
         }
+    };
+
+    if (dynamic) {
+        // the processes take the next repetition when they are done with
+        // one, so the repetitions with many steps don't pile up on one
+        if (rank < totalUsedCores)
+            for (size_t r = counter->next(); r < input.repetitions;
+                 r = counter->next())
+                runRepetition(r);
+        counter.reset();
+    } else {
+        for (size_t r = start_index; r < end_index; r++)
+            runRepetition(r);
     }
 
-    if (rank == 0){
-        // receive results from other processes
-
-        // gather best distSquaredSums
-        std::vector<double> distSquaredSums;
-        distSquaredSums.resize(totalCores);
-        MPI_Gather(&out.bestDistSquaredSum, 1, MPI_DOUBLE, distSquaredSums.data(), 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-
-        // gather iteration of best cluster
-        std::vector<int> it_of_best_clusters;
-        it_of_best_clusters.resize(totalCores);
-        MPI_Gather(&it_of_best_cluster, 1, MPI_INT, it_of_best_clusters.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
-        
-        // gather best clusters
-        // std::vector<int> bestClusters;
-        // bestClusters.resize(totalCores*input.numPoints);
-        // MPI_Gather(out.bestClusters.data(), input.numPoints, MPI_INT, bestClusters.data(), input.numPoints, MPI_INT, 0, MPI_COMM_WORLD);
-
-        // reduce num steps per repetition
-        std::vector<int> steps;
-        steps.resize(out.stepsPerRepetition.size());
-        MPI_Reduce(out.stepsPerRepetition.data(), steps.data(), out.stepsPerRepetition.size(), MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+    // Every process hands in its results as soon as its last repetition is
+    // done, and packs its clusters while it waits for the slowest process.
+    // The best result is the smallest sum with the lowest repetition, which
+    // is how MINLOC breaks ties. A process without repetitions has nothing
+    // to offer.
+    struct {
+        double distSquaredSum;
+        int repetition;
+    } own, best;
+    const bool haveResult =
+        out.bestDistSquaredSum != std::numeric_limits<double>::max();
+    own.distSquaredSum = out.bestDistSquaredSum;
+    own.repetition = haveResult ? (int)it_of_best_cluster
+                                : std::numeric_limits<int>::max();
+
+    MPI_Request requests[3];
+    MPI_Iallreduce(&own, &best, 1, MPI_DOUBLE_INT, MPI_MINLOC, MPI_COMM_WORLD,
+                   &requests[0]);
+
+    // num steps per repetition: every repetition ran on one process
+    std::vector<int> steps(rank == 0 ? out.stepsPerRepetition.size() : 0);
+    MPI_Ireduce(out.stepsPerRepetition.data(), steps.data(),
+                out.stepsPerRepetition.size(), MPI_INT, MPI_MAX, 0,
+                MPI_COMM_WORLD, &requests[1]);
+
+    // sum the distance calculations of all processes
+    unsigned long long distances[2] = {out.distanceCalculations, out.skippedDistanceCalculations};
+    unsigned long long totalDistances[2];
+    MPI_Ireduce(distances, totalDistances, 2, MPI_UNSIGNED_LONG_LONG, MPI_SUM,
+                0, MPI_COMM_WORLD, &requests[2]);
+
+    // any process may have the best clusters; it sends them to process 0,
+    // which already has them when it is that process
+    std::vector<char> labels;
+    if (haveResult && rank != 0)
+        packLabels(out.bestClusters, input.numClusters, labels);
+    else if (rank == 0)
+        labels.resize(input.numPoints * labelWidth(input.numClusters));
+
+    MPI_Wait(&requests[0], MPI_STATUS_IGNORE);
+    const bool isBest = haveResult && best.repetition == own.repetition;
+    const bool receive = !isBest && rank == 0 &&
+                         best.repetition != std::numeric_limits<int>::max();
+    MPI_Request labelRequest = MPI_REQUEST_NULL;
+    if (isBest && rank != 0)
+        MPI_Isend(labels.data(), labels.size(), MPI_BYTE, 0, 0,
+                  MPI_COMM_WORLD, &labelRequest);
+    else if (receive)
+        MPI_Irecv(labels.data(), labels.size(), MPI_BYTE, MPI_ANY_SOURCE, 0,
+                  MPI_COMM_WORLD, &labelRequest);
+    MPI_Waitall(2, requests + 1, MPI_STATUSES_IGNORE);
+    MPI_Wait(&labelRequest, MPI_STATUS_IGNORE);
+
+    if (rank == 0) {
+        if (receive)
+            unpackLabels(labels, input.numClusters, out.bestClusters);
+        out.bestDistSquaredSum = best.distSquaredSum;
         out.stepsPerRepetition = steps;
-
-        // find best cluster from all repetitions
-        int bestClusterSrcRank = 0;
-        for (int i = 0; i < totalCores;++i){
-            if (distSquaredSums[i] <= out.bestDistSquaredSum) {
-                // take the best clusters from te lowest repetition
-                if (distSquaredSums[i] != out.bestDistSquaredSum || it_of_best_clusters[i] < it_of_best_cluster){
-                    bestClusterSrcRank = i;
-                    out.bestDistSquaredSum = distSquaredSums[i];
-                    it_of_best_cluster = it_of_best_clusters[i];
-                }
-            }
-        }
-        getBestCluster(bestClusterSrcRank, input.numPoints, out.bestClusters);
-
-    } else {
-        // send results to process 0
-        MPI_Gather(&out.bestDistSquaredSum, 1, MPI_DOUBLE, nullptr, 0, MPI_DOUBLE, 0, MPI_COMM_WORLD);
-        MPI_Gather(&it_of_best_cluster, 1, MPI_INT, nullptr, 0, MPI_INT, 0, MPI_COMM_WORLD);
-        // MPI_Gather(out.bestClusters.data(), input.numPoints, MPI_INT, nullptr, 0, MPI_INT, 0, MPI_COMM_WORLD);
-        MPI_Reduce(out.stepsPerRepetition.data(), nullptr, out.stepsPerRepetition.size(), MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
-        
-        // Recv broadcast who has best cluster
-        int srcRank;
-        MPI_Bcast(&srcRank, 1, MPI_INT, 0, MPI_COMM_WORLD);
-
-        // If has best cluster send to root process (0)
-        if (rank == srcRank) {
-            int tag = 0;
-            MPI_Send(out.bestClusters.data(), input.numPoints, MPI_INT, 0, tag, MPI_COMM_WORLD);
-        }
+        out.distanceCalculations = totalDistances[0];
+        out.skippedDistanceCalculations = totalDistances[1];
     }
     return out;
 }
@@ -1,18 +1,24 @@
 #include "helper_functions.h"
 #include "kmeans.h"
+#include "lloyd_step.h"
+#include "seeding.h"
 #include <iostream>
 #include <omp.h>
 
 struct KMeansItInput {
     const size_t numPoints;
     const size_t pointSize;
-    const std::vector<double> &allData;
-    std::vector<Point> &centroids;
+    const double *allData;
+    CentroidMatrix &centroids;
     std::vector<int>& pointCounts;
     const int numClusters;
     FileCSVWriter &centroidDebugFile;
     FileCSVWriter &clustersDebugFile;
+    const KMeansKernels &kernels;
+    const KMeansOptions &options;
+    const EngineData *engineData;
     int numThreads;
+    LloydStepPool &stepPool;
 };
 
 struct KMeansItOutput {
@@ -20,36 +26,32 @@ struct KMeansItOutput {
     std::vector<int> bestClusters;
     double bestDistSquaredSum;
     std::vector<int> clusters;
+    unsigned long long distanceCalculations = 0;
+    unsigned long long skippedDistanceCalculations = 0;
 };
 
 int kmeansOpenMPIteration(KMeansItOutput &out, KMeansItInput &in) {
 
     bool changed = true;
     out.numSteps = 0;
+    std::unique_ptr<LloydStep> step =
+        in.stepPool.take(in.options, in.engineData, in.numPoints,
+                         in.numClusters, in.pointSize);
 
     while (changed) {
-        changed = false;
-        double distSquaredSum = 0;
+        double distSquaredSum;
+        in.centroids.updateBlocked();
 
-        #pragma omp parallel for schedule(static) num_threads(in.numThreads) reduction(+:distSquaredSum)
-        for (size_t pointIndex = 0; pointIndex < in.numPoints; pointIndex++) {
-            int newCluster;
-            double dist;
+        // assign the points and sum them per cluster in one pass. Every chunk
+        // is a task, so threads that have no repetition of their own left
+        // help out with the chunks of the ones still running.
+        #pragma omp taskloop default(shared) grainsize(1)
+        for (size_t chunk = 0; chunk < step->numChunks(); chunk++)
+            step->processChunk(chunk, in.kernels, in.allData, in.centroids,
+                               out.clusters.data());
 
-            findClosestCentroidIndexAndDistance(pointIndex, in.pointSize,
-                                                in.allData, in.centroids,
-                                                newCluster, dist);
-
-            distSquaredSum += dist;
-
-            if (newCluster != out.clusters[pointIndex]) {
-                out.clusters[pointIndex] = newCluster;
-                changed = true;
-            }
-        }
-        if (changed) // re-calculate the centroids based on current clustering
-            moveCentroidsToAverage(in.centroids, out.clusters, in.numPoints,
-                                   in.pointSize, in.allData, in.pointCounts);
+        // re-calculate the centroids based on current clustering
+        changed = step->finish(in.centroids, in.pointCounts, distSquaredSum);
 
         // Keep track of best clustering
         if (distSquaredSum < out.bestDistSquaredSum) {
@@ -59,9 +61,116 @@ int kmeansOpenMPIteration(KMeansItOutput &out, KMeansItInput &in) {
         ++out.numSteps;
     }
 
+    out.distanceCalculations += step->distanceCalculations();
+    out.skippedDistanceCalculations += step->skippedDistanceCalculations();
+    in.stepPool.giveBack(std::move(step));
     return 0;
 }
 
+// Runs repetitions [first, last) in lockstep. Every step, each chunk of
+// points is assigned for all repetitions of the batch that did not converge
+// yet, one after the other while the chunk is in cache, so the dataset is
+// streamed once per step for the whole batch instead of once per repetition.
+// The threads share the chunks. Every repetition keeps its own LloydStep, so
+// it computes exactly the same as in kmeansOpenMPIteration.
+//
+// The static schedule gives every thread the same chunks each step. The
+// cluster arrays are set to -1 in that schedule too, so their pages end up
+// on the NUMA node of the thread that assigns those points, like the points
+// themselves (see placePoints).
+void kmeansOpenMPBatch(size_t first, size_t last, const KMeansIn &input,
+                       LloydStepPool &stepPool,
+                       std::vector<CentroidMatrix> &centroids,
+                       std::vector<KMeansItOutput> &outputs) {
+    const size_t batchSize = last - first;
+    std::vector<std::unique_ptr<LloydStep>> steps(batchSize);
+    std::vector<std::vector<int>> pointCounts(
+        batchSize, std::vector<int>(input.numClusters));
+    std::vector<UninitializedVector<int>> clusters(batchSize);
+    std::vector<size_t> active; // indices in the batch
+
+    for (size_t b = 0; b < batchSize; b++) {
+        steps[b] = stepPool.take(input.options, input.engineData,
+                                 input.numPoints, input.numClusters,
+                                 input.pointSize);
+        outputs[b].bestDistSquaredSum = std::numeric_limits<double>::max();
+        clusters[b].resize(input.numPoints);
+        outputs[b].numSteps = 0;
+        active.push_back(b);
+    }
+    const size_t numChunks = steps[0]->numChunks();
+
+    #pragma omp parallel for schedule(static) num_threads(input.numThreads)
+    for (size_t chunk = 0; chunk < numChunks; chunk++) {
+        size_t begin, end;
+        steps[0]->chunkRange(chunk, begin, end);
+        for (size_t b = 0; b < batchSize; b++)
+            std::fill(clusters[b].begin() + begin, clusters[b].begin() + end,
+                      -1);
+    }
+
+    while (!active.empty()) {
+        for (size_t b : active)
+            centroids[first + b].updateBlocked();
+
+        // assign the points and sum them per cluster, for all repetitions
+        #pragma omp parallel for schedule(static) num_threads(input.numThreads)
+        for (size_t chunk = 0; chunk < numChunks; chunk++)
+            for (size_t b : active)
+                steps[b]->processChunk(chunk, input.kernels, input.allData,
+                                       centroids[first + b],
+                                       clusters[b].data());
+
+        // re-calculate the centroids, converged repetitions leave the batch
+        std::vector<size_t> stillActive;
+        for (size_t b : active) {
+            KMeansItOutput &out = outputs[b];
+            double distSquaredSum;
+            const bool changed = steps[b]->finish(
+                centroids[first + b], pointCounts[b], distSquaredSum);
+
+            // Keep track of best clustering
+            if (distSquaredSum < out.bestDistSquaredSum) {
+                out.bestClusters.assign(clusters[b].begin(),
+                                        clusters[b].end());
+                out.bestDistSquaredSum = distSquaredSum;
+            }
+            ++out.numSteps;
+
+            if (changed) {
+                stillActive.push_back(b);
+            } else {
+                out.clusters.assign(clusters[b].begin(), clusters[b].end());
+                out.distanceCalculations += steps[b]->distanceCalculations();
+                out.skippedDistanceCalculations +=
+                    steps[b]->skippedDistanceCalculations();
+                stepPool.giveBack(std::move(steps[b]));
+            }
+        }
+        active.swap(stillActive);
+    }
+}
+
+// Adds the result of repetition r, which ended at 'centroids', to the
+// overall result
+void addRepetitionResult(KmeansOut &out, size_t &it_of_best_cluster, size_t r,
+                         const KMeansItOutput &itoutput,
+                         const CentroidMatrix &centroids) {
+    out.stepsPerRepetition[r] = itoutput.numSteps;
+    out.distanceCalculations += itoutput.distanceCalculations;
+    out.skippedDistanceCalculations += itoutput.skippedDistanceCalculations;
+    if (itoutput.bestDistSquaredSum <= out.bestDistSquaredSum) {
+
+        // take the best clusters from te lowest repetition
+        if (itoutput.bestDistSquaredSum != out.bestDistSquaredSum || r < it_of_best_cluster){
+            out.bestClusters = itoutput.clusters;
+            out.bestCentroids = centroids;
+            out.bestDistSquaredSum = itoutput.bestDistSquaredSum;
+            it_of_best_cluster = r;
+        }
+    }
+}
+
 KmeansOut kmeansOpenMP(KMeansIn input) {
     KmeansOut out;
     out.stepsPerRepetition.resize(input.repetitions);
@@ -69,51 +178,80 @@ KmeansOut kmeansOpenMP(KMeansIn input) {
     out.bestClusters = std::vector<int>(input.numPoints, -1);
     size_t it_of_best_cluster = 0;
 
-    std::vector<std::vector<Point>> centroids_per_repetition(input.repetitions, std::vector<Point>(input.numClusters));
+    std::vector<CentroidMatrix> centroids_per_repetition(input.repetitions, CentroidMatrix(input.numClusters, input.pointSize));
 
+    // the steps of the repetitions, kept for the next ones
+    LloydStepPool ownStepPool;
+    LloydStepPool &stepPool = input.stepPool ? *input.stepPool : ownStepPool;
+
+    // Random centroids are picked for several repetitions at once (unless
+    // the legacy generator needs them in order), k-means++ and k-means||
+    // use the threads for their passes over the dataset instead
+    #pragma omp parallel for num_threads(input.numThreads) \
+        if(input.options.init == KMeansInit::Random && \
+           canChooseCentroidsIndependently(input.options, input.rng))
     for (size_t r = 0; r < input.repetitions; r++) {
-        chooseCentroidsAtRandomFromDataset(input.rng, input.numPoints,
-                                                input.pointSize, input.allData,
-                                                centroids_per_repetition[r]);
+        chooseInitialCentroids(input.options, input.rng, r, input.kernels,
+                               input.allData, input.numPoints,
+                               input.pointSize, input.numThreads,
+                               centroids_per_repetition[r]);
+    }
+
+    // Batched mode: the repetitions run in blocks that share the passes over
+    // the dataset
+    const size_t batchSize = input.options.repetitionBatchSize;
+    if (batchSize > 1) {
+        for (size_t first = 0; first < input.repetitions; first += batchSize) {
+            const size_t last = std::min(first + batchSize, (size_t)input.repetitions);
+            std::vector<KMeansItOutput> outputs(last - first);
+            kmeansOpenMPBatch(first, last, input, stepPool,
+                              centroids_per_repetition, outputs);
+            for (size_t r = first; r < last; r++)
+                addRepetitionResult(out, it_of_best_cluster, r,
+                                    outputs[r - first],
+                                    centroids_per_repetition[r]);
+        }
+        return out;
     }
 
     // Do the k-means routine a number of times, each time starting from
     // different random centroids (use Rng::pickRandomIndices), and keep
     // the best result of these repetitions.
-    #pragma omp parallel for schedule(dynamic) num_threads(input.numThreads)
+    //
+    // Every repetition is a task, and so is every chunk of points it
+    // assigns (see kmeansOpenMPIteration). While there are more repetitions
+    // than threads, each thread runs its own one; once they run out, the
+    // idle threads take chunk tasks of the repetitions that are left, so no
+    // thread waits for a long repetition to converge.
+    #pragma omp parallel num_threads(input.numThreads)
+    #pragma omp single
     for (size_t r = 0; r < input.repetitions; r++) {
+        #pragma omp task default(shared) firstprivate(r)
+        {
+            std::vector<int> pointCounts;
+            pointCounts.resize(input.numClusters);
 
-        std::vector<int> pointCounts;
-        pointCounts.resize(input.numClusters);
+            // Create the iteration parameters
+            KMeansItInput itinput{input.numPoints,        input.pointSize,
+                                input.allData,          centroids_per_repetition[r], pointCounts,
+                                input.numClusters,      input.centroidDebugFile,
+                                input.clustersDebugFile, input.kernels, input.options, input.engineData, input.numThreads,
+                                stepPool};
 
-        // Create the iteration parameters
-        KMeansItInput itinput{input.numPoints,        input.pointSize,
-                            input.allData,          centroids_per_repetition[r], pointCounts,
-                            input.numClusters,      input.centroidDebugFile,
-                            input.clustersDebugFile, input.numThreads};
+            // create iteration output struct
+            KMeansItOutput itoutput;
+            itoutput.bestDistSquaredSum = std::numeric_limits<double>::max();
+            // Init closest centroid index for every point: 'unknown'(-1)
+            itoutput.clusters = std::vector<int>(input.numPoints, -1);
+            itoutput.numSteps = 0;
 
-        // create iteration output struct
-        KMeansItOutput itoutput;
-        itoutput.bestDistSquaredSum = std::numeric_limits<double>::max();
-        // Init closest centroid index for every point: 'unknown'(-1)
-        itoutput.clusters = std::vector<int>(input.numPoints, -1);
-        itoutput.numSteps = 0;
+            // start iteration
+            kmeansOpenMPIteration(itoutput, itinput);
 
-        // start iteration
-        kmeansOpenMPIteration(itoutput, itinput);
-
-        // update num of steps for this iteration
-        out.stepsPerRepetition[r] = itoutput.numSteps;
-
-        #pragma omp critical
-        if (itoutput.bestDistSquaredSum <= out.bestDistSquaredSum) {
-
-            // take the best clusters from te lowest repetition
-            if (itoutput.bestDistSquaredSum != out.bestDistSquaredSum || r < it_of_best_cluster){
-                out.bestClusters = itoutput.clusters;
-                out.bestDistSquaredSum = itoutput.bestDistSquaredSum;
-                it_of_best_cluster = r;
-            }
+            // update num of steps and the best result
+            #pragma omp critical
+            addRepetitionResult(out, it_of_best_cluster, r, itoutput,
+                                centroids_per_repetition[r]);
         }
     }
 
@@ -1,73 +1,80 @@
 #include "helper_functions.h"
 #include "kmeans.h"
+#include "lloyd_step.h"
+#include "seeding.h"
 #include <iostream>
 
 struct KMeansItInput {
     const size_t numPoints;
     const size_t pointSize;
-    const std::vector<double> &allData;
-    std::vector<Point> &centroids;
+    const double *allData;
+    CentroidMatrix &centroids;
     std::vector<int>& pointCounts;
     const int numClusters;
     FileCSVWriter &centroidDebugFile;
     FileCSVWriter &clustersDebugFile;
+    const KMeansKernels &kernels;
+    const KMeansOptions &options;
+    const EngineData *engineData;
+    LloydStepPool &stepPool;
 };
 
 struct KMeansItOutput {
     size_t numSteps;
     std::vector<int> bestClusters;
+    CentroidMatrix bestCentroids;
     double bestDistSquaredSum;
     std::vector<int> clusters;
+    unsigned long long distanceCalculations = 0;
+    unsigned long long skippedDistanceCalculations = 0;
 };
 
 int kmeansSerialIteration(KMeansItOutput &out, KMeansItInput &in) {
 
     bool changed = true;
     out.numSteps = 0;
+    std::unique_ptr<LloydStep> step =
+        in.stepPool.take(in.options, in.engineData, in.numPoints,
+                         in.numClusters, in.pointSize);
 
     // write starting step clusters and centroids to the debug files if open
     if (in.centroidDebugFile.is_open())
-        in.centroidDebugFile.write(in.centroids);
+        in.centroidDebugFile.write(in.centroids.data(),
+                                   in.centroids.numCentroids(), in.pointSize);
     if (in.clustersDebugFile.is_open())
         in.clustersDebugFile.write(out.clusters);
 
     while (changed) {
-        changed = false;
-        double distSquaredSum = 0;
+        double distSquaredSum;
+        in.centroids.updateBlocked();
 
-        for (size_t pointIndex = 0; pointIndex < in.numPoints; pointIndex++) {
-            int newCluster;
-            double dist;
+        // assign the points and sum them per cluster in one pass
+        for (size_t chunk = 0; chunk < step->numChunks(); chunk++)
+            step->processChunk(chunk, in.kernels, in.allData, in.centroids,
+                               out.clusters.data());
 
-            findClosestCentroidIndexAndDistance(pointIndex, in.pointSize,
-                                                in.allData, in.centroids,
-                                                newCluster, dist);
-
-            distSquaredSum += dist;
-
-            if (newCluster != out.clusters[pointIndex]) {
-                out.clusters[pointIndex] = newCluster;
-                changed = true;
-            }
-        }
-        if (changed) // re-calculate the centroids based on current clustering
-            moveCentroidsToAverage(in.centroids, out.clusters, in.numPoints,
-                                   in.pointSize, in.allData, in.pointCounts);
+        // re-calculate the centroids based on current clustering
+        changed = step->finish(in.centroids, in.pointCounts, distSquaredSum);
 
         // Keep track of best clustering
         if (distSquaredSum < out.bestDistSquaredSum) {
             out.bestClusters = out.clusters;
+            out.bestCentroids = in.centroids;
             out.bestDistSquaredSum = distSquaredSum;
         }
         ++out.numSteps;
 
         // write the step to the debug files if open
         if (in.centroidDebugFile.is_open())
-            in.centroidDebugFile.write(in.centroids);
+            in.centroidDebugFile.write(in.centroids.data(),
+                                       in.centroids.numCentroids(), in.pointSize);
         if (in.clustersDebugFile.is_open())
             in.clustersDebugFile.write(out.clusters);
     }
 
+    out.distanceCalculations += step->distanceCalculations();
+    out.skippedDistanceCalculations += step->skippedDistanceCalculations();
+    in.stepPool.giveBack(std::move(step));
     return 0;
 }
 
@@ -80,12 +87,17 @@ KmeansOut kmeansSerial(KMeansIn input) {
     std::vector<int> pointCounts;
     pointCounts.resize(input.numClusters);
 
+    // the steps of the repetitions, kept for the next one
+    LloydStepPool ownStepPool;
+    LloydStepPool &stepPool = input.stepPool ? *input.stepPool : ownStepPool;
+
     // Create the iteration parameters
-    std::vector<Point> centroids(input.numClusters);
+    CentroidMatrix centroids(input.numClusters, input.pointSize);
     KMeansItInput itinput{input.numPoints,        input.pointSize,
                           input.allData,          centroids, pointCounts,
                           input.numClusters,      input.centroidDebugFile,
-                          input.clustersDebugFile};
+                          input.clustersDebugFile, input.kernels, input.options,
+                          input.engineData,       stepPool};
 
     // create iteration output struct
     KMeansItOutput itoutput;
@@ -97,11 +109,12 @@ KmeansOut kmeansSerial(KMeansIn input) {
     // the best result of these repetitions.
     for (size_t r = 0; r < input.repetitions; r++) {
 
-        // Pick k random centroid points from the dataset, with k the number of
+        // Pick k centroid points from the dataset, with k the number of
         // clusters.
-        chooseCentroidsAtRandomFromDataset(input.rng, input.numPoints,
-                                           input.pointSize, input.allData,
-                                           itinput.centroids);
+        chooseInitialCentroids(input.options, input.rng, r, input.kernels,
+                               input.allData, input.numPoints,
+                               input.pointSize, input.numThreads,
+                               itinput.centroids);
 
         // Init closest centroid index for every point: 'unknown'(-1)
         std::fill(itoutput.clusters.begin(), itoutput.clusters.end(), -1);
@@ -117,6 +130,12 @@ KmeansOut kmeansSerial(KMeansIn input) {
         input.clustersDebugFile.close();
     }
 
-    return {itoutput.bestDistSquaredSum, itoutput.bestClusters,
-            stepsPerRepetition};
+    KmeansOut out;
+    out.bestDistSquaredSum = itoutput.bestDistSquaredSum;
+    out.bestClusters = std::move(itoutput.bestClusters);
+    out.stepsPerRepetition = std::move(stepsPerRepetition);
+    out.bestCentroids = std::move(itoutput.bestCentroids);
+    out.distanceCalculations = itoutput.distanceCalculations;
+    out.skippedDistanceCalculations = itoutput.skippedDistanceCalculations;
+    return out;
 }
\ No newline at end of file
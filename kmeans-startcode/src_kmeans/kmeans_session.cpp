@@ -0,0 +1,127 @@
+#include "kmeans_session.h"
+#include <limits>
+#include <stdexcept>
+
+KMeansSession::KMeansSession(const double *allData, size_t numPoints,
+                             size_t pointSize, int numThreads,
+                             const KMeansOptions &options)
+    : m_options{options}, m_numThreads{numThreads}, m_allData{allData},
+      m_numPoints{numPoints}, m_pointSize{pointSize} {
+    prepare();
+}
+
+KMeansSession::KMeansSession(std::vector<double> &&allData, size_t numPoints,
+                             size_t pointSize, int numThreads,
+                             const KMeansOptions &options)
+    : m_options{options}, m_numThreads{numThreads} {
+    if (allData.size() != numPoints * pointSize)
+        throw std::invalid_argument("Dataset size does not match its shape");
+    m_dataset.assign(std::move(allData), numPoints, pointSize);
+    m_allData = m_dataset.data();
+    m_numPoints = numPoints;
+    m_pointSize = pointSize;
+    prepare();
+}
+
+KMeansSession::KMeansSession(const std::string &fileName, bool useDataCache,
+                             int numThreads, const KMeansOptions &options)
+    : m_options{options}, m_numThreads{numThreads} {
+    readDataset(fileName, useDataCache, false, m_dataset);
+    m_allData = m_dataset.data();
+    m_numPoints = m_dataset.numRows();
+    m_pointSize = m_dataset.numCols();
+    prepare();
+}
+
+void KMeansSession::prepare() {
+    m_backend = m_options.backend;
+    if (m_backend == KMeansBackend::Auto)
+        m_backend = isBackendAvailable(KMeansBackend::OpenMP)
+                        ? KMeansBackend::OpenMP
+                        : KMeansBackend::Serial;
+    if (m_backend != KMeansBackend::Serial &&
+        !(m_backend == KMeansBackend::OpenMP && isBackendAvailable(m_backend)))
+        throw std::invalid_argument(std::string("The ") +
+                                    backendName(m_backend) +
+                                    " backend can not run in a session");
+    if (m_numThreads < 1)
+        throw std::invalid_argument("A session needs at least one thread");
+
+    m_kernels = selectKernels(m_pointSize);
+    m_engineData =
+        prepareEngineData(m_options, m_allData, m_numPoints, m_pointSize);
+    m_stepPool.reset(new LloydStepPool);
+
+    // start the threads of the later calls
+    #pragma omp parallel num_threads(m_numThreads)
+    {
+    }
+}
+
+KMeansFit KMeansSession::fit(int numClusters, int repetitions,
+                             unsigned long seed) {
+    if (numClusters < 1 || (size_t)numClusters > m_numPoints ||
+        repetitions < 1 || seed == 0)
+        throw std::invalid_argument("Invalid number of clusters, repetitions "
+                                    "or seed");
+
+    Rng rng(seed);
+    FileCSVWriter noDebugFile;
+    KMeansIn input{repetitions, rng, numClusters, 1, m_numThreads,
+                   m_numPoints, m_pointSize, m_allData, noDebugFile,
+                   noDebugFile, m_kernels, m_options, m_engineData.get(),
+                   m_stepPool.get()};
+
+    KMeansFit fit;
+    if (m_backend == KMeansBackend::OpenMP)
+        fit.result = kmeansOpenMP(input);
+    else
+        fit.result = kmeansSerial(input);
+
+    fit.centroids = std::move(fit.result.bestCentroids);
+    fit.centroids.updateBlocked();
+    return fit;
+}
+
+std::vector<KMeansFit>
+KMeansSession::fitManySeeds(int numClusters, int repetitions,
+                            const std::vector<unsigned long> &seeds) {
+    std::vector<KMeansFit> fits;
+    fits.reserve(seeds.size());
+    for (unsigned long seed : seeds)
+        fits.push_back(fit(numClusters, repetitions, seed));
+    return fits;
+}
+
+std::vector<int> KMeansSession::predict(const CentroidMatrix &centroids,
+                                        const double *points,
+                                        size_t numPoints) const {
+    if (centroids.pointSize() != m_pointSize)
+        throw std::invalid_argument("Centroids do not match the dataset");
+
+    // the kernels read the blocked copy
+    CentroidMatrix blocked = centroids;
+    blocked.updateBlocked();
+
+    std::vector<int> clusters(numPoints);
+    #pragma omp parallel for schedule(static) num_threads(m_numThreads)
+    for (size_t i = 0; i < numPoints; i++) {
+        const double *point = points + i * m_pointSize;
+        double dist;
+        m_kernels.closestCentroid(point, m_pointSize, blocked, clusters[i],
+                                  dist);
+        if (clusters[i] >= 0)
+            continue;
+
+        // distances too large for the kernels
+        dist = std::numeric_limits<double>::infinity();
+        for (size_t c = 0; c < blocked.numCentroids(); c++) {
+            const double d = squaredDistance(point, blocked[c], m_pointSize);
+            if (d < dist) {
+                clusters[i] = c;
+                dist = d;
+            }
+        }
+    }
+    return clusters;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "BinaryDataset.h"
+#include "kmeans.h"
+#include "lloyd_step.h"
+#include <memory>
+
+// The result of KMeansSession::fit: the best clustering of the repetitions,
+// and the centroids its last step left (the average of the points of each
+// cluster, the origin for a cluster without points)
+struct KMeansFit {
+    KmeansOut result;
+    CentroidMatrix centroids;
+};
+
+// Runs k-means in-process on one dataset, many times (the 'libkmeans'
+// library, see the Makefile). The dataset, its kernels and the data the
+// engine derives from it are prepared once, when the session is created,
+// and shared by all later calls; the OpenMP threads are started then too and
+// stay around between the calls. The steps of the repetitions, with their
+// partial sums and bounds, are kept for later calls with the same number of
+// clusters. A session only runs the serial and OpenMP
+// backends (KMeansBackend::Auto is OpenMP if the library is built with it);
+// the other options apply as they do on the command line.
+//
+// A session runs one call at a time. The results are those of the command
+// line with the same options and seed, and the counter based generator.
+class KMeansSession {
+  public:
+    // Uses the dataset in place, it must outlive the session
+    KMeansSession(const double *allData, size_t numPoints, size_t pointSize,
+                  int numThreads = 1,
+                  const KMeansOptions &options = KMeansOptions());
+    // Takes over the dataset
+    KMeansSession(std::vector<double> &&allData, size_t numPoints,
+                  size_t pointSize, int numThreads = 1,
+                  const KMeansOptions &options = KMeansOptions());
+    // Loads a CSV or binary dataset file, see --input and --cache
+    KMeansSession(const std::string &fileName, bool useDataCache = false,
+                  int numThreads = 1,
+                  const KMeansOptions &options = KMeansOptions());
+
+    size_t numPoints() const { return m_numPoints; }
+    size_t pointSize() const { return m_pointSize; }
+
+    // Clusters the dataset in numClusters clusters, keeping the best of
+    // 'repetitions' runs from initial centroids chosen with 'seed'.
+    // Throws std::invalid_argument for impossible arguments.
+    KMeansFit fit(int numClusters, int repetitions, unsigned long seed);
+
+    // fit for every seed in turn
+    std::vector<KMeansFit> fitManySeeds(int numClusters, int repetitions,
+                                        const std::vector<unsigned long> &seeds);
+
+    // The index of the closest of the centroids for each of the points,
+    // which have pointSize() values each
+    std::vector<int> predict(const CentroidMatrix &centroids,
+                             const double *points, size_t numPoints) const;
+
+  private:
+    void prepare();
+
+    KMeansOptions m_options;
+    KMeansBackend m_backend;
+    int m_numThreads;
+
+    Dataset m_dataset; // empty if the dataset is not ours
+    const double *m_allData;
+    size_t m_numPoints;
+    size_t m_pointSize;
+
+    KMeansKernels m_kernels;
+    std::unique_ptr<const EngineData> m_engineData;
+    std::unique_ptr<LloydStepPool> m_stepPool;
+};
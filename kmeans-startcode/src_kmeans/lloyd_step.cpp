@@ -0,0 +1,287 @@
+#include "lloyd_step.h"
+#include "elkan_step.h"
+#include "gemm_step.h"
+#include "hamerly_step.h"
+#include "kdtree_step.h"
+#include "yinyang_step.h"
+#include <algorithm>
+
+namespace {
+
+// Chunks of at least this many points, and not more chunks than needed to
+// keep a few dozen threads busy or than fit in a reasonable amount of
+// memory for the partial sums
+const size_t minChunkPoints = 1024;
+const size_t maxChunks = 256;
+const size_t maxPartialBytes = 16 << 20;
+
+size_t chooseNumChunks(size_t numPoints, size_t numClusters,
+                       size_t pointSize) {
+    size_t chunks = (numPoints + minChunkPoints - 1) / minChunkPoints;
+    chunks = std::min(chunks, maxChunks);
+    chunks = std::min(chunks, maxPartialBytes / (numClusters * (pointSize + 1) *
+                                                 sizeof(double)));
+    return std::max(chunks, (size_t)1);
+}
+
+} // namespace
+
+void LloydStep::chunkLayout(size_t numPoints, size_t numClusters,
+                            size_t pointSize, size_t &numChunks,
+                            size_t &chunkSize) {
+    numChunks = chooseNumChunks(numPoints, numClusters, pointSize);
+    chunkSize = (numPoints + numChunks - 1) / numChunks;
+}
+
+LloydStep::LloydStep(size_t numPoints, size_t numClusters, size_t pointSize,
+                     int incrementalUpdateInterval)
+    : m_numPoints{numPoints}, m_numClusters{numClusters},
+      m_pointSize{pointSize},
+      m_numChunks{chooseNumChunks(numPoints, numClusters, pointSize)},
+      m_chunkSize{(numPoints + m_numChunks - 1) / m_numChunks},
+      m_interval{(size_t)std::max(incrementalUpdateInterval, 0)}, m_step{0},
+      m_sums(m_numChunks * numClusters * pointSize),
+      m_counts(m_numChunks * numClusters), m_distSquaredSums(m_numChunks),
+      m_changed(m_numChunks), m_distanceCounts(m_numChunks), m_numSteps{0},
+      m_distanceCalculations{0} {
+    if (m_interval > 0) {
+        m_runningSums.resize(numClusters * pointSize);
+        m_runningCounts.resize(numClusters);
+    }
+}
+
+void LloydStep::restart() {
+    m_step = 0;
+    m_numSteps = 0;
+    m_distanceCalculations = 0;
+}
+
+void LloydStep::startChunk(size_t chunk, size_t &begin, size_t &end,
+                           double *&sums, int *&counts) {
+    sums = m_sums.data() + chunk * m_numClusters * m_pointSize;
+    counts = m_counts.data() + chunk * m_numClusters;
+    std::fill(sums, sums + m_numClusters * m_pointSize, 0);
+    std::fill(counts, counts + m_numClusters, 0);
+
+    chunkRange(chunk, begin, end);
+}
+
+// per chunk: the sums, the counts, distSquaredSum, changed and the number of
+// distances calculated
+void LloydStep::packChunks(size_t first, size_t last,
+                           std::vector<double> &buffer) const {
+    const size_t size = m_numClusters * m_pointSize;
+    const size_t packedSize = size + m_numClusters + 3;
+    buffer.assign(m_numChunks * packedSize, 0);
+    for (size_t chunk = first; chunk < last; chunk++) {
+        double *p = buffer.data() + chunk * packedSize;
+        p = std::copy(m_sums.begin() + chunk * size,
+                      m_sums.begin() + (chunk + 1) * size, p);
+        p = std::copy(m_counts.begin() + chunk * m_numClusters,
+                      m_counts.begin() + (chunk + 1) * m_numClusters, p);
+        p[0] = m_distSquaredSums[chunk];
+        p[1] = m_changed[chunk];
+        p[2] = m_distanceCounts[chunk];
+    }
+}
+
+void LloydStep::unpackChunks(const std::vector<double> &buffer) {
+    const size_t size = m_numClusters * m_pointSize;
+    const size_t packedSize = size + m_numClusters + 3;
+    for (size_t chunk = 0; chunk < m_numChunks; chunk++) {
+        const double *p = buffer.data() + chunk * packedSize;
+        std::copy(p, p + size, m_sums.begin() + chunk * size);
+        p += size;
+        std::copy(p, p + m_numClusters,
+                  m_counts.begin() + chunk * m_numClusters);
+        p += m_numClusters;
+        m_distSquaredSums[chunk] = p[0];
+        m_changed[chunk] = p[1] != 0;
+        m_distanceCounts[chunk] = p[2];
+    }
+}
+
+void LloydStep::copyChunkClusters(size_t first, size_t last,
+                                  const std::vector<int> &clusters,
+                                  std::vector<int> &out) const {
+    // the chunks after the last start at the end of the points
+    size_t begin, end, unused;
+    chunkRange(first, begin, unused);
+    chunkRange(last, end, unused);
+    std::copy(clusters.begin() + begin, clusters.begin() + end,
+              out.begin() + begin);
+}
+
+void LloydStep::processChunk(size_t chunk, const KMeansKernels &kernels,
+                             const double *allData,
+                             const CentroidMatrix &centroids,
+                             int *clusters) {
+    size_t begin, end;
+    double *sums;
+    int *counts;
+    startChunk(chunk, begin, end, sums, counts);
+
+    double distSquaredSum = 0;
+    bool changed = false;
+
+    const AssignAndAccumulateKernel kernel =
+        isIncrementalStep() ? kernels.assignAndAccumulateChanges
+                            : kernels.assignAndAccumulate;
+    kernel(kernels.closestCentroid, allData, begin, end, m_pointSize, centroids,
+           clusters, sums, counts, distSquaredSum, changed);
+
+    endChunk(chunk, distSquaredSum, changed, (end - begin) * m_numClusters);
+}
+
+bool LloydStep::finish(CentroidMatrix &centroids,
+                       std::vector<int> &pointCounts, double &distSquaredSum) {
+    bool changed = false;
+    distSquaredSum = 0;
+    for (size_t chunk = 0; chunk < m_numChunks; chunk++) {
+        distSquaredSum += m_distSquaredSums[chunk];
+        changed = changed || m_changed[chunk];
+        m_distanceCalculations += m_distanceCounts[chunk];
+    }
+    m_numSteps++;
+    if (!changed)
+        return false;
+
+    if (m_interval > 0)
+        return finishIncremental(centroids, pointCounts);
+
+    // reset all centroids and counters to 0
+    const size_t size = m_numClusters * m_pointSize;
+    double *c = centroids.data();
+    std::fill(c, c + size, 0);
+    std::fill(pointCounts.begin(), pointCounts.end(), 0);
+
+    for (size_t chunk = 0; chunk < m_numChunks; chunk++) {
+        const double *sums = m_sums.data() + chunk * size;
+        const int *counts = m_counts.data() + chunk * m_numClusters;
+        for (size_t i = 0; i < size; i++)
+            c[i] += sums[i];
+        for (size_t i = 0; i < m_numClusters; i++)
+            pointCounts[i] += counts[i];
+    }
+
+    // average out the centroids
+    for (size_t i = 0; i < m_numClusters; ++i) {
+        if (pointCounts[i] > 0)
+            for (size_t dim = 0; dim < m_pointSize; dim++)
+                centroids[i][dim] /= pointCounts[i];
+    }
+    return true;
+}
+
+bool LloydStep::finishIncremental(CentroidMatrix &centroids,
+                                  std::vector<int> &pointCounts) {
+    const size_t size = m_numClusters * m_pointSize;
+    double *running = m_runningSums.data();
+
+    // a full step starts over from the sums of all points, the others add
+    // the differences of the points that moved
+    if (!isIncrementalStep()) {
+        std::fill(m_runningSums.begin(), m_runningSums.end(), 0);
+        std::fill(m_runningCounts.begin(), m_runningCounts.end(), 0);
+    }
+    for (size_t chunk = 0; chunk < m_numChunks; chunk++) {
+        const double *sums = m_sums.data() + chunk * size;
+        const int *counts = m_counts.data() + chunk * m_numClusters;
+        for (size_t i = 0; i < size; i++)
+            running[i] += sums[i];
+        for (size_t i = 0; i < m_numClusters; i++)
+            m_runningCounts[i] += counts[i];
+    }
+    m_step++;
+
+    // average out the centroids
+    std::copy(m_runningCounts.begin(), m_runningCounts.end(),
+              pointCounts.begin());
+    for (size_t i = 0; i < m_numClusters; ++i) {
+        for (size_t dim = 0; dim < m_pointSize; dim++)
+            centroids[i][dim] = pointCounts[i] > 0
+                                    ? running[i * m_pointSize + dim] /
+                                          pointCounts[i]
+                                    : 0;
+    }
+    return true;
+}
+
+std::unique_ptr<const EngineData>
+prepareEngineData(const KMeansOptions &options, const double *allData,
+                  size_t numPoints, size_t pointSize, size_t firstPoint,
+                  size_t lastPoint) {
+    if (options.engine == KMeansEngine::KdTree)
+        return std::unique_ptr<const EngineData>(
+            new KdTree(allData, numPoints, pointSize));
+    if (options.engine == KMeansEngine::Gemm)
+        return std::unique_ptr<const EngineData>(
+            new PointNorms(allData, numPoints, pointSize, firstPoint,
+                           std::min(lastPoint, numPoints)));
+    return nullptr;
+}
+
+std::unique_ptr<LloydStep> createLloydStep(const KMeansOptions &options,
+                                           const EngineData *engineData,
+                                           size_t numPoints,
+                                           size_t numClusters,
+                                           size_t pointSize) {
+    const int interval = options.incrementalUpdateInterval;
+    switch (options.engine) {
+    case KMeansEngine::Elkan:
+        return std::unique_ptr<LloydStep>(
+            new ElkanStep(numPoints, numClusters, pointSize, interval));
+    case KMeansEngine::Hamerly:
+        return std::unique_ptr<LloydStep>(
+            new HamerlyStep(numPoints, numClusters, pointSize, interval));
+    case KMeansEngine::Yinyang:
+        return std::unique_ptr<LloydStep>(
+            new YinyangStep(numPoints, numClusters, pointSize, interval));
+    case KMeansEngine::KdTree:
+        return std::unique_ptr<LloydStep>(new KdTreeStep(
+            static_cast<const KdTree &>(*engineData), numClusters));
+    case KMeansEngine::Gemm:
+        return std::unique_ptr<LloydStep>(
+            new GemmStep(static_cast<const PointNorms &>(*engineData),
+                         numPoints, numClusters, pointSize, interval));
+    case KMeansEngine::Lloyd:
+    default:
+        return std::unique_ptr<LloydStep>(
+            new LloydStep(numPoints, numClusters, pointSize, interval));
+    }
+}
+
+std::unique_ptr<LloydStep> LloydStepPool::take(const KMeansOptions &options,
+                                               const EngineData *engineData,
+                                               size_t numPoints,
+                                               size_t numClusters,
+                                               size_t pointSize) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (options.engine != m_engine ||
+            options.incrementalUpdateInterval != m_interval ||
+            engineData != m_engineData || numPoints != m_numPoints ||
+            numClusters != m_numClusters || pointSize != m_pointSize) {
+            m_steps.clear();
+            m_engine = options.engine;
+            m_interval = options.incrementalUpdateInterval;
+            m_engineData = engineData;
+            m_numPoints = numPoints;
+            m_numClusters = numClusters;
+            m_pointSize = pointSize;
+        }
+        if (!m_steps.empty()) {
+            std::unique_ptr<LloydStep> step = std::move(m_steps.back());
+            m_steps.pop_back();
+            step->restart();
+            return step;
+        }
+    }
+    return createLloydStep(options, engineData, numPoints, numClusters,
+                           pointSize);
+}
+
+void LloydStepPool::giveBack(std::unique_ptr<LloydStep> step) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_steps.push_back(std::move(step));
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include "AlignedAllocator.h"
+#include "helper_functions.h"
+#include "kmeans.h"
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+// A fused Lloyd step: every point is assigned to its closest centroid and, in
+// the same pass over the data, added to per-cluster partial sums and counts.
+// Averaging these afterwards only costs k x d work, so the data is read once
+// per step and the update scales with the number of threads.
+//
+// The points are split in a fixed number of chunks, which depends only on
+// the shape of the problem. processChunk can be called for different chunks
+// concurrently; finish adds the partial results in chunk order, so the
+// centroids and distance sums are bit-identical for every number of threads,
+// and for every backend using this class.
+//
+// With an incrementalUpdateInterval N > 0 the per-cluster sums are kept
+// between steps: only every N-th step (and the first) sums all points, the
+// steps in between only move the points that changed cluster from their old
+// sum to their new one. Late in a run few points move, so this saves most of
+// the accumulation work, at the cost of results that are no longer
+// bit-identical to the full recompute.
+//
+// Engines that find the closest centroids in another way (see
+// createLloydStep) derive from this class and reuse the chunks and the
+// centroid update.
+class LloydStep {
+  public:
+    LloydStep(size_t numPoints, size_t numClusters, size_t pointSize,
+              int incrementalUpdateInterval = 0);
+    virtual ~LloydStep() {}
+
+    size_t numChunks() const { return m_numChunks; }
+
+    // Brings the step back to where it was after its construction, for a
+    // new repetition, keeping its memory (see LloydStepPool)
+    virtual void restart();
+
+    // The chunks of every step of a problem of this shape: 'numChunks'
+    // chunks of 'chunkSize' points, the last one may have fewer
+    static void chunkLayout(size_t numPoints, size_t numClusters,
+                            size_t pointSize, size_t &numChunks,
+                            size_t &chunkSize);
+
+    // The points [begin, end) of a chunk (empty past the last chunk)
+    void chunkRange(size_t chunk, size_t &begin, size_t &end) const {
+        begin = std::min(chunk * m_chunkSize, m_numPoints);
+        end = std::min(begin + m_chunkSize, m_numPoints);
+    }
+
+    virtual void processChunk(size_t chunk, const KMeansKernels &kernels,
+                              const double *allData,
+                              const CentroidMatrix &centroids,
+                              int *clusters);
+
+    // Combines the chunks, returns whether any point changed cluster. If so,
+    // the centroids are moved to the average of their points (clusters
+    // without points end up at the origin, like moveCentroidsToAverage does).
+    virtual bool finish(CentroidMatrix &centroids,
+                        std::vector<int> &pointCounts, double &distSquaredSum);
+
+    // The number of point to centroid distances calculated in the steps so
+    // far, and how many of the numPoints x numClusters per step were skipped
+    unsigned long long distanceCalculations() const {
+        return m_distanceCalculations;
+    }
+    unsigned long long skippedDistanceCalculations() const {
+        return m_numSteps * m_numPoints * m_numClusters -
+               m_distanceCalculations;
+    }
+
+    // For processes that each handle some of the chunks: packs the partial
+    // results of the chunks [first, last) in 'buffer', with zeros for all
+    // other chunks. Adding up the buffers of all processes gives those of
+    // all chunks, exactly, since every value comes from one process only;
+    // unpackChunks then stores them for finish.
+    void packChunks(size_t first, size_t last,
+                    std::vector<double> &buffer) const;
+    void unpackChunks(const std::vector<double> &buffer);
+
+    // Copies the clusters of the points in the chunks [first, last) from
+    // 'clusters' to 'out'
+    virtual void copyChunkClusters(size_t first, size_t last,
+                                   const std::vector<int> &clusters,
+                                   std::vector<int> &out) const;
+
+  protected:
+    // Zeroes the partial sums and counts of a chunk and returns them, with
+    // the range [begin, end) of points in the chunk
+    void startChunk(size_t chunk, size_t &begin, size_t &end, double *&sums,
+                    int *&counts);
+    void endChunk(size_t chunk, double distSquaredSum, bool changed,
+                  size_t distanceCalculations) {
+        m_distSquaredSums[chunk] = distSquaredSum;
+        m_changed[chunk] = changed;
+        m_distanceCounts[chunk] = distanceCalculations;
+    }
+
+    // whether the current step only accumulates the changed points
+    bool isIncrementalStep() const {
+        return m_interval > 0 && m_step % m_interval != 0;
+    }
+
+    // Adds point p to the partial sums of its new cluster, or in an
+    // incremental step moves it there from its old one if it changed
+    void accumulatePoint(const double *p, int oldCluster, int newCluster,
+                         bool incremental, double *sums, int *counts) const {
+        double *sum = sums + newCluster * m_pointSize;
+        if (!incremental) {
+            for (size_t dim = 0; dim < m_pointSize; ++dim)
+                sum[dim] += p[dim];
+            counts[newCluster] += 1;
+        } else if (newCluster != oldCluster) {
+            double *oldSum = sums + oldCluster * m_pointSize;
+            for (size_t dim = 0; dim < m_pointSize; ++dim) {
+                oldSum[dim] -= p[dim];
+                sum[dim] += p[dim];
+            }
+            counts[oldCluster] -= 1;
+            counts[newCluster] += 1;
+        }
+    }
+
+    size_t m_numPoints;
+    size_t m_numClusters;
+    size_t m_pointSize;
+
+  private:
+    bool finishIncremental(CentroidMatrix &centroids,
+                           std::vector<int> &pointCounts);
+
+    size_t m_numChunks;
+    size_t m_chunkSize;
+    size_t m_interval;
+    size_t m_step;
+
+    // per chunk, first written by the thread that processes the chunk
+    UninitializedVector<double> m_sums; // numClusters x pointSize
+    UninitializedVector<int> m_counts;  // numClusters
+    std::vector<double> m_distSquaredSums;
+    std::vector<char> m_changed;
+    std::vector<size_t> m_distanceCounts;
+
+    unsigned long long m_numSteps;
+    unsigned long long m_distanceCalculations;
+
+    // sums and counts kept between steps in incremental mode
+    std::vector<double> m_runningSums;
+    std::vector<int> m_runningCounts;
+};
+
+// Read-only data an engine derives from the dataset, once per run, and
+// shares between all repetitions and threads
+class EngineData {
+  public:
+    virtual ~EngineData() {}
+};
+
+// The data for the engine selected in the options, nullptr if it needs none.
+// Only the points [firstPoint, lastPoint) need to be present, except for the
+// kd-tree.
+std::unique_ptr<const EngineData>
+prepareEngineData(const KMeansOptions &options, const double *allData,
+                  size_t numPoints, size_t pointSize, size_t firstPoint = 0,
+                  size_t lastPoint = std::numeric_limits<size_t>::max());
+
+// The step of the engine selected in the options, for one repetition
+std::unique_ptr<LloydStep> createLloydStep(const KMeansOptions &options,
+                                           const EngineData *engineData,
+                                           size_t numPoints,
+                                           size_t numClusters,
+                                           size_t pointSize);
+
+// Keeps the steps of finished repetitions for the next ones, so that their
+// partial sums and bounds are allocated once per run, or once per
+// KMeansSession for as long as the shape of its problem stays the same.
+// Several threads can take and give back steps at the same time.
+class LloydStepPool {
+  public:
+    // A step as createLloydStep gives it; the kept ones are dropped if the
+    // engine or the shape of the problem changed
+    std::unique_ptr<LloydStep> take(const KMeansOptions &options,
+                                    const EngineData *engineData,
+                                    size_t numPoints, size_t numClusters,
+                                    size_t pointSize);
+    void giveBack(std::unique_ptr<LloydStep> step);
+
+  private:
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<LloydStep>> m_steps;
+
+    // what the kept steps were made for
+    KMeansEngine m_engine = KMeansEngine::Lloyd;
+    int m_interval = 0;
+    const EngineData *m_engineData = nullptr;
+    size_t m_numPoints = 0;
+    size_t m_numClusters = 0;
+    size_t m_pointSize = 0;
+};
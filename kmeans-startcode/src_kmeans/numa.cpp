@@ -0,0 +1,230 @@
+#include "numa.h"
+#include "lloyd_step.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+
+// Parses a CPU list like "0-3,8,10-11"
+std::vector<int> parseCpuList(const std::string &list) {
+    std::vector<int> cpus;
+    std::istringstream ranges(list);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        int first, last;
+        const int numbers = sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (numbers == 1)
+            last = first;
+        else if (numbers != 2)
+            continue;
+        for (int cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// The opposite of parseCpuList
+std::string formatCpuList(const std::vector<int> &cpus) {
+    std::ostringstream list;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+            j++;
+        list << (i > 0 ? "," : "") << cpus[i];
+        if (j > i)
+            list << "-" << cpus[j];
+        i = j + 1;
+    }
+    return list.str();
+}
+
+} // namespace
+
+NumaTopology::NumaTopology() {
+    std::vector<int> allowed;
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &set))
+                allowed.push_back(cpu);
+
+    // the node directories, in the order of their numbers
+    std::vector<int> nodeIds;
+    if (DIR *dir = opendir("/sys/devices/system/node")) {
+        while (dirent *entry = readdir(dir)) {
+            int id;
+            if (sscanf(entry->d_name, "node%d", &id) == 1)
+                nodeIds.push_back(id);
+        }
+        closedir(dir);
+    }
+    std::sort(nodeIds.begin(), nodeIds.end());
+
+    for (int id : nodeIds) {
+        std::ifstream file("/sys/devices/system/node/node" +
+                           std::to_string(id) + "/cpulist");
+        std::string list;
+        std::getline(file, list);
+        std::vector<int> cpus;
+        for (int cpu : parseCpuList(list))
+            if (std::binary_search(allowed.begin(), allowed.end(), cpu))
+                cpus.push_back(cpu);
+        if (!cpus.empty()) {
+            m_nodeIds.push_back(id);
+            m_nodeCpus.push_back(cpus);
+        }
+    }
+#endif
+    if (m_nodeCpus.empty()) {
+        if (allowed.empty())
+            for (unsigned cpu = 0; cpu < std::thread::hardware_concurrency();
+                 cpu++)
+                allowed.push_back(cpu);
+        m_nodeIds.push_back(0);
+        m_nodeCpus.push_back(allowed);
+    }
+}
+
+std::string NumaTopology::describe() const {
+    std::ostringstream text;
+    text << numNodes() << " NUMA node" << (numNodes() == 1 ? "" : "s")
+         << " (";
+    for (size_t node = 0; node < numNodes(); node++)
+        text << (node > 0 ? ", " : "") << m_nodeIds[node] << ": cpus "
+             << formatCpuList(m_nodeCpus[node]);
+    text << ")";
+    return text.str();
+}
+
+int NumaTopology::cpuForThread(ThreadPinning pinning, int thread) const {
+    if (pinning == ThreadPinning::Scatter) {
+        const std::vector<int> &cpus = m_nodeCpus[thread % numNodes()];
+        return cpus[thread / numNodes() % cpus.size()];
+    }
+
+    size_t numCpus = 0;
+    for (const std::vector<int> &cpus : m_nodeCpus)
+        numCpus += cpus.size();
+    size_t index = thread % std::max(numCpus, (size_t)1);
+    for (const std::vector<int> &cpus : m_nodeCpus) {
+        if (index < cpus.size())
+            return cpus[index];
+        index -= cpus.size();
+    }
+    return 0;
+}
+
+int NumaTopology::nodeOfCpu(int cpu) const {
+    for (size_t node = 0; node < numNodes(); node++)
+        if (std::binary_search(m_nodeCpus[node].begin(),
+                               m_nodeCpus[node].end(), cpu))
+            return (int)node;
+    return -1;
+}
+
+void pinThreads(const NumaTopology &topology, ThreadPinning pinning,
+                int numThreads) {
+#if defined(_OPENMP) && defined(__linux__)
+    if (pinning == ThreadPinning::None)
+        return;
+    #pragma omp parallel num_threads(numThreads)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(topology.cpuForThread(pinning, omp_get_thread_num()), &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+#endif
+}
+
+UninitializedVector<double> placePoints(const double *allData,
+                                        size_t numPoints, size_t pointSize,
+                                        size_t numClusters, int numThreads) {
+    size_t numChunks, chunkSize;
+    LloydStep::chunkLayout(numPoints, numClusters, pointSize, numChunks,
+                           chunkSize);
+
+    UninitializedVector<double> placed(numPoints * pointSize);
+    #pragma omp parallel for schedule(static) num_threads(numThreads)
+    for (size_t chunk = 0; chunk < numChunks; chunk++) {
+        const size_t begin = std::min(chunk * chunkSize, numPoints);
+        const size_t end = std::min(begin + chunkSize, numPoints);
+        std::copy(allData + begin * pointSize, allData + end * pointSize,
+                  placed.begin() + begin * pointSize);
+    }
+    return placed;
+}
+
+UninitializedVector<double> interleavePoints(const NumaTopology &topology,
+                                             const double *allData,
+                                             size_t numPoints,
+                                             size_t pointSize,
+                                             int numThreads) {
+    UninitializedVector<double> placed(numPoints * pointSize);
+    const size_t numValues = placed.size();
+    if (numValues == 0)
+        return placed;
+
+    // the stripes are the pages the values lie in, the first one may be
+    // partly before the start of the copy
+    size_t pageSize = 4096;
+#ifdef __linux__
+    pageSize = std::max(sysconf(_SC_PAGESIZE), (long)sizeof(double));
+#endif
+    const size_t stripeValues = pageSize / sizeof(double);
+    const size_t offset =
+        (size_t)((uintptr_t)placed.data() % pageSize) / sizeof(double);
+    const size_t numStripes =
+        (offset + numValues + stripeValues - 1) / stripeValues;
+
+    // the node each thread runs on, and the threads of each node
+    const size_t numNodes = topology.numNodes();
+    std::vector<int> threadNodes(numThreads, -1);
+#if defined(_OPENMP) && defined(__linux__)
+    #pragma omp parallel num_threads(numThreads)
+    threadNodes[omp_get_thread_num()] = topology.nodeOfCpu(sched_getcpu());
+#endif
+    std::vector<std::vector<int>> nodeThreads(numNodes);
+    for (int thread = 0; thread < numThreads; thread++)
+        if (threadNodes[thread] >= 0)
+            nodeThreads[threadNodes[thread]].push_back(thread);
+
+    #pragma omp parallel num_threads(numThreads)
+    {
+#ifdef _OPENMP
+        const int thread = omp_get_thread_num();
+#else
+        const int thread = 0;
+#endif
+        for (size_t stripe = 0; stripe < numStripes; stripe++) {
+            const std::vector<int> &threads = nodeThreads[stripe % numNodes];
+            const size_t turn = stripe / numNodes;
+            const int owner = threads.empty()
+                                  ? (int)(turn % numThreads)
+                                  : threads[turn % threads.size()];
+            if (owner != thread)
+                continue;
+            const size_t begin =
+                std::max(stripe * stripeValues, offset) - offset;
+            const size_t end =
+                std::min((stripe + 1) * stripeValues - offset, numValues);
+            std::copy(allData + begin, allData + end, placed.begin() + begin);
+        }
+    }
+    return placed;
+}
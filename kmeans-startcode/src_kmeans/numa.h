@@ -0,0 +1,58 @@
+#pragma once
+
+#include "AlignedAllocator.h"
+#include "kmeans.h"
+#include <string>
+#include <vector>
+
+// The NUMA nodes of the machine with the CPUs of each that this process may
+// run on, from /sys/devices/system/node on Linux. Without that information,
+// a single node with all allowed CPUs.
+class NumaTopology {
+  public:
+    NumaTopology();
+
+    size_t numNodes() const { return m_nodeCpus.size(); }
+
+    // e.g. "2 NUMA nodes (0: cpus 0-15, 1: cpus 16-31)"
+    std::string describe() const;
+
+    // The CPU of thread 'thread' of a team: Compact gives the threads the
+    // CPUs of a node before going to the next one, Scatter takes the nodes
+    // in turn. With more threads than CPUs, they start over.
+    int cpuForThread(ThreadPinning pinning, int thread) const;
+
+    // The node (0 to numNodes() - 1) of a CPU, -1 if it is not one of ours
+    int nodeOfCpu(int cpu) const;
+
+  private:
+    std::vector<int> m_nodeIds;
+    std::vector<std::vector<int>> m_nodeCpus;
+};
+
+// Pins every thread of an OpenMP team of numThreads to a CPU. The OpenMP
+// runtime keeps these threads for the later parallel regions of at most that
+// size. Does nothing for ThreadPinning::None or without OpenMP.
+void pinThreads(const NumaTopology &topology, ThreadPinning pinning,
+                int numThreads);
+
+// Copies the points to memory that each chunk of points of a LloydStep for
+// this problem is first written to by the thread that gets the chunk in a
+// static schedule of numThreads threads, like kmeansOpenMPBatch uses. This
+// puts the pages of the chunk on the NUMA node of that thread.
+UninitializedVector<double> placePoints(const double *allData,
+                                        size_t numPoints, size_t pointSize,
+                                        size_t numClusters, int numThreads);
+
+// Copies the points to memory whose pages are written first by the threads
+// of a team of numThreads, taking the NUMA nodes in turn: page i goes to a
+// thread on node i % numNodes, the threads of a node take its pages in turn.
+// For kmeansOpenMPIteration, where every thread reads all points, this
+// spreads the points over the memory of all nodes instead of one. The
+// threads should be pinned (see pinThreads); pages of a node without
+// threads are shared by all.
+UninitializedVector<double> interleavePoints(const NumaTopology &topology,
+                                             const double *allData,
+                                             size_t numPoints,
+                                             size_t pointSize,
+                                             int numThreads);
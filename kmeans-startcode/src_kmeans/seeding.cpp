@@ -0,0 +1,342 @@
+#include "seeding.h"
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+// Points per block of the minimum distances
+const size_t seedingBlockSize = SeedingComm::blockSize;
+
+// k-means||: the number of sampling rounds, and the number of points
+// expected per round as a multiple of k
+const int parallelRounds = 5;
+const double parallelOversampling = 2;
+
+// Added to the repetition for the stream that selects the k-means|| samples
+const uint64_t selectionStreamFlag = 1ull << 63;
+
+size_t numSeedingBlocks(size_t numPoints) {
+    return SeedingComm::numBlocks(numPoints);
+}
+
+// The closest of the centroids, also for distances too large for the kernels
+void findClosest(const KMeansKernels &kernels, const double *point,
+                 size_t pointSize, const CentroidMatrix &centroids,
+                 int &closest, double &dist) {
+    kernels.closestCentroid(point, pointSize, centroids, closest, dist);
+    if (closest >= 0)
+        return;
+    dist = std::numeric_limits<double>::infinity();
+    for (size_t c = 0; c < centroids.numCentroids(); c++) {
+        const double d = squaredDistance(point, centroids[c], pointSize);
+        if (d < dist) {
+            closest = c;
+            dist = d;
+        }
+    }
+}
+
+// Lowers the minimum distances of the points in the blocks [firstBlock,
+// lastBlock) with their distances to 'centroids', and sums them per block
+void updateMinDistances(const KMeansKernels &kernels, const double *allData,
+                        size_t numPoints, size_t pointSize,
+                        const CentroidMatrix &centroids, size_t firstBlock,
+                        size_t lastBlock, int numThreads,
+                        std::vector<double> &minDist,
+                        std::vector<double> &blockSums) {
+    #pragma omp parallel for schedule(static) num_threads(numThreads)
+    for (size_t b = firstBlock; b < lastBlock; b++) {
+        const size_t end = std::min((b + 1) * seedingBlockSize, numPoints);
+        double sum = 0;
+        for (size_t i = b * seedingBlockSize; i < end; i++) {
+            int closest;
+            double dist;
+            findClosest(kernels, allData + i * pointSize, pointSize,
+                        centroids, closest, dist);
+            minDist[i] = std::min(minDist[i], dist);
+            sum += minDist[i];
+        }
+        blockSums[b] = sum;
+    }
+}
+
+// The index at which the running sum of 'values' passes 'target', skipping
+// zeros; the last non-zero value if rounding makes it run past the end
+size_t pickAt(const double *values, size_t begin, size_t end, double target) {
+    size_t last = begin;
+    for (size_t i = begin; i < end; i++) {
+        if (values[i] <= 0)
+            continue;
+        if (target < values[i])
+            return i;
+        target -= values[i];
+        last = i;
+    }
+    return last;
+}
+
+// Picks a point with a probability proportional to its minimum distance,
+// first the block, then the point in it
+size_t pickByDistance(const std::vector<double> &minDist,
+                      const std::vector<double> &blockSums, size_t numPoints,
+                      double target) {
+    const size_t b = pickAt(blockSums.data(), 0, blockSums.size(), target);
+    for (size_t i = 0; i < b; i++)
+        target -= blockSums[i];
+    return pickAt(minDist.data(), b * seedingBlockSize,
+                  std::min((b + 1) * seedingBlockSize, numPoints),
+                  std::min(target, blockSums[b]));
+}
+
+double sumOf(const std::vector<double> &values) {
+    double sum = 0;
+    for (double v : values)
+        sum += v;
+    return sum;
+}
+
+void copyPoint(const SeedingComm &comm, const double *allData,
+               size_t numPoints, size_t pointSize, size_t index,
+               double *centroid) {
+    comm.copyPoints(allData, numPoints, pointSize, {index}, centroid);
+}
+
+void chooseKMeansPlusPlus(Rng &rng, size_t repetition,
+                          const KMeansKernels &kernels, const double *allData,
+                          size_t numPoints, size_t pointSize, int numThreads,
+                          CentroidMatrix &centroids, const SeedingComm &comm) {
+    PhiloxStream random = rng.stream(repetition);
+    const size_t numBlocks = numSeedingBlocks(numPoints);
+    size_t firstBlock, lastBlock;
+    comm.blockRange(numBlocks, firstBlock, lastBlock);
+    std::vector<double> minDist(numPoints,
+                                std::numeric_limits<double>::infinity());
+    std::vector<double> blockSums(numBlocks);
+    CentroidMatrix added(1, pointSize);
+
+    size_t index = random.nextBelow(numPoints);
+    for (size_t c = 0;; c++) {
+        copyPoint(comm, allData, numPoints, pointSize, index, centroids[c]);
+        if (c + 1 == centroids.numCentroids())
+            break;
+
+        std::copy(centroids[c], centroids[c] + pointSize, added[0]);
+        added.updateBlocked();
+        std::fill(blockSums.begin(), blockSums.end(), 0);
+        updateMinDistances(kernels, allData, numPoints, pointSize, added,
+                           firstBlock, lastBlock, numThreads, minDist,
+                           blockSums);
+        comm.sum(blockSums);
+
+        // only duplicates left: any point will do
+        const double total = sumOf(blockSums);
+        if (total == 0) {
+            index = random.nextBelow(numPoints);
+            continue;
+        }
+
+        // the block follows from the sums, the point in it from the
+        // distances that only the process of the block has
+        const double target = random.nextDouble() * total;
+        const size_t b = pickAt(blockSums.data(), 0, numBlocks, target);
+        std::vector<double> picked{0};
+        if (b >= firstBlock && b < lastBlock)
+            picked[0] = pickByDistance(minDist, blockSums, numPoints, target);
+        comm.sum(picked);
+        index = picked[0];
+    }
+}
+
+// k-means++ on the candidates of k-means|| (their points in 'candidatePoints'),
+// each weighted with the number of points closest to it
+void chooseWeightedKMeansPlusPlus(PhiloxStream &random,
+                                  const std::vector<size_t> &candidates,
+                                  const CentroidMatrix &candidatePoints,
+                                  const std::vector<double> &weights,
+                                  const double *allData, size_t numPoints,
+                                  size_t pointSize,
+                                  CentroidMatrix &centroids,
+                                  const SeedingComm &comm) {
+    std::vector<double> minDist(candidates.size(),
+                                std::numeric_limits<double>::infinity());
+    std::vector<double> chances(weights);
+
+    for (size_t c = 0;; c++) {
+        // fewer distinct candidates than clusters: any point will do
+        const double total = sumOf(chances);
+        if (total > 0) {
+            const double *point = candidatePoints[pickAt(
+                chances.data(), 0, chances.size(), random.nextDouble() * total)];
+            std::copy(point, point + pointSize, centroids[c]);
+        } else {
+            copyPoint(comm, allData, numPoints, pointSize,
+                      random.nextBelow(numPoints), centroids[c]);
+        }
+        if (c + 1 == centroids.numCentroids())
+            break;
+
+        for (size_t j = 0; j < candidates.size(); j++) {
+            minDist[j] = std::min(minDist[j],
+                                  squaredDistance(candidatePoints[j],
+                                                  centroids[c], pointSize));
+            chances[j] = weights[j] * minDist[j];
+        }
+    }
+}
+
+void chooseKMeansParallel(Rng &rng, size_t repetition,
+                          const KMeansKernels &kernels, const double *allData,
+                          size_t numPoints, size_t pointSize, int numThreads,
+                          CentroidMatrix &centroids, const SeedingComm &comm) {
+    PhiloxStream random = rng.stream(repetition);
+    const PhiloxStream selection = rng.stream(repetition | selectionStreamFlag);
+    const size_t numBlocks = numSeedingBlocks(numPoints);
+    size_t firstBlock, lastBlock;
+    comm.blockRange(numBlocks, firstBlock, lastBlock);
+    const size_t firstPoint = firstBlock * seedingBlockSize;
+    const size_t lastPoint = std::min(lastBlock * seedingBlockSize, numPoints);
+
+    std::vector<double> minDist(numPoints,
+                                std::numeric_limits<double>::infinity());
+    std::vector<double> blockSums(numBlocks);
+    std::vector<size_t> candidates{random.nextBelow(numPoints)};
+    size_t numOld = 0;
+
+    for (int round = 0;; round++) {
+        // lower the distances with the candidates of the last round
+        CentroidMatrix added(candidates.size() - numOld, pointSize);
+        comm.copyPoints(allData, numPoints, pointSize,
+                        std::vector<size_t>(candidates.begin() + numOld,
+                                            candidates.end()),
+                        added.data());
+        added.updateBlocked();
+        std::fill(blockSums.begin(), blockSums.end(), 0);
+        updateMinDistances(kernels, allData, numPoints, pointSize, added,
+                           firstBlock, lastBlock, numThreads, minDist,
+                           blockSums);
+        comm.sum(blockSums);
+
+        const double total = sumOf(blockSums);
+        if (round == parallelRounds || total == 0)
+            break;
+
+        // every point becomes a candidate with a probability proportional
+        // to its distance, so that about 'expected' of them do
+        const double expected = parallelOversampling * centroids.numCentroids();
+        std::vector<std::vector<size_t>> selected(numBlocks);
+        #pragma omp parallel for schedule(static) num_threads(numThreads)
+        for (size_t b = firstBlock; b < lastBlock; b++) {
+            const size_t end = std::min((b + 1) * seedingBlockSize, numPoints);
+            for (size_t i = b * seedingBlockSize; i < end; i++)
+                if (selection.uniformAt(round * numPoints + i) * total <
+                    expected * minDist[i])
+                    selected[b].push_back(i);
+        }
+
+        // share them, in the order of the points
+        std::vector<double> counts(numBlocks, 0);
+        for (size_t b = firstBlock; b < lastBlock; b++)
+            counts[b] = selected[b].size();
+        comm.sum(counts);
+        std::vector<double> indices((size_t)sumOf(counts), 0);
+        size_t offset = 0;
+        for (size_t b = 0; b < numBlocks; b++) {
+            std::copy(selected[b].begin(), selected[b].end(),
+                      indices.begin() + offset);
+            offset += counts[b];
+        }
+        comm.sum(indices);
+
+        numOld = candidates.size();
+        candidates.insert(candidates.end(), indices.begin(), indices.end());
+    }
+
+    // weigh the candidates with the number of points closest to them
+    CentroidMatrix all(candidates.size(), pointSize);
+    comm.copyPoints(allData, numPoints, pointSize, candidates, all.data());
+    all.updateBlocked();
+    std::vector<double> weights(candidates.size(), 0);
+    #pragma omp parallel num_threads(numThreads)
+    {
+        // whole numbers, so the order of the sums does not matter
+        std::vector<double> threadWeights(candidates.size(), 0);
+        #pragma omp for schedule(static)
+        for (size_t i = firstPoint; i < lastPoint; i++) {
+            int closest;
+            double dist;
+            findClosest(kernels, allData + i * pointSize, pointSize, all,
+                        closest, dist);
+            threadWeights[closest] += 1;
+        }
+        #pragma omp critical
+        for (size_t j = 0; j < candidates.size(); j++)
+            weights[j] += threadWeights[j];
+    }
+    comm.sum(weights);
+
+    chooseWeightedKMeansPlusPlus(random, candidates, all, weights, allData,
+                                 numPoints, pointSize, centroids, comm);
+}
+
+} // namespace
+
+void SeedingComm::pointRange(size_t numPoints, size_t &first,
+                             size_t &last) const {
+    size_t firstBlock, lastBlock;
+    blockRange(numBlocks(numPoints), firstBlock, lastBlock);
+    first = std::min(firstBlock * blockSize, numPoints);
+    last = std::min(lastBlock * blockSize, numPoints);
+}
+
+int SeedingComm::pointOwner(size_t numPoints, size_t index) const {
+    // the last process whose first block is not after that of the point
+    return ((index / blockSize + 1) * m_numProcesses - 1) /
+           numBlocks(numPoints);
+}
+
+void SeedingComm::copyPoints(const double *allData, size_t numPoints,
+                             size_t pointSize,
+                             const std::vector<size_t> &indices,
+                             double *to) const {
+    for (size_t index : indices)
+        to = std::copy(allData + index * pointSize,
+                       allData + (index + 1) * pointSize, to);
+}
+
+bool canChooseCentroidsIndependently(const KMeansOptions &options,
+                                     const Rng &rng) {
+    switch (options.init) {
+    case KMeansInit::Random:
+        return !rng.isLegacy();
+    case KMeansInit::KMeansPlusPlus:
+        return true;
+    case KMeansInit::KMeansParallel:
+        return false; // the processes share the passes over the dataset
+    }
+    return false;
+}
+
+void chooseInitialCentroids(const KMeansOptions &options, Rng &rng,
+                            size_t repetition, const KMeansKernels &kernels,
+                            const double *allData, size_t numPoints,
+                            size_t pointSize, int numThreads,
+                            CentroidMatrix &centroids,
+                            const SeedingComm &comm) {
+    switch (options.init) {
+    case KMeansInit::Random: {
+        std::vector<size_t> indices(centroids.numCentroids());
+        rng.pickRandomIndices(repetition, numPoints, indices);
+        comm.copyPoints(allData, numPoints, pointSize, indices,
+                        centroids.data());
+        break;
+    }
+    case KMeansInit::KMeansPlusPlus:
+        chooseKMeansPlusPlus(rng, repetition, kernels, allData, numPoints,
+                             pointSize, numThreads, centroids, comm);
+        break;
+    case KMeansInit::KMeansParallel:
+        chooseKMeansParallel(rng, repetition, kernels, allData, numPoints,
+                             pointSize, numThreads, centroids, comm);
+        break;
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "helper_functions.h"
+#include "kmeans.h"
+
+// Splits the passes over the dataset of k-means++ and k-means|| between
+// processes. The
+// points are divided in fixed blocks; each process works on a range of them
+// and sums its per-block results with those of the others. The blocks do not
+// depend on the number of processes and every value is set by one process
+// only, so the centroids are the same for any number of processes. The base
+// class is a single process.
+//
+// A process only reads the points of its own blocks; the chosen points are
+// copied from the processes they belong to, so a process needs no others.
+class SeedingComm {
+  public:
+    static const size_t blockSize = 1024; // points
+
+    SeedingComm(int rank = 0, int numProcesses = 1)
+        : m_rank{rank}, m_numProcesses{numProcesses} {}
+    virtual ~SeedingComm() {}
+
+    static size_t numBlocks(size_t numPoints) {
+        return (numPoints + blockSize - 1) / blockSize;
+    }
+
+    // The blocks [first, last) of 'numBlocks' this process works on
+    void blockRange(size_t numBlocks, size_t &first, size_t &last) const {
+        first = numBlocks * m_rank / m_numProcesses;
+        last = numBlocks * (m_rank + 1) / m_numProcesses;
+    }
+
+    // The points [first, last) of the blocks of this process
+    void pointRange(size_t numPoints, size_t &first, size_t &last) const;
+
+    // The process whose blocks hold point 'index'
+    int pointOwner(size_t numPoints, size_t index) const;
+
+    // Adds up 'values' element-wise over all processes, into all of them
+    virtual void sum(std::vector<double> &values) const {}
+
+    // Copies the points with the given indices to 'to', one after the other.
+    // All processes call this together, with the same indices.
+    virtual void copyPoints(const double *allData, size_t numPoints,
+                            size_t pointSize,
+                            const std::vector<size_t> &indices,
+                            double *to) const;
+
+  protected:
+    int rank() const { return m_rank; }
+    int numProcesses() const { return m_numProcesses; }
+
+  private:
+    int m_rank;
+    int m_numProcesses;
+};
+
+// Whether the initial centroids of a repetition can be chosen without the
+// others: in any order, on any thread and, with MPI, only on the rank that
+// runs it. If not, every process must choose those of all repetitions, in
+// order.
+bool canChooseCentroidsIndependently(const KMeansOptions &options,
+                                     const Rng &rng);
+
+// Chooses the initial centroids of 'repetition' with the method selected in
+// the options. The passes over the dataset use up to 'numThreads' threads.
+void chooseInitialCentroids(const KMeansOptions &options, Rng &rng,
+                            size_t repetition, const KMeansKernels &kernels,
+                            const double *allData, size_t numPoints,
+                            size_t pointSize, int numThreads,
+                            CentroidMatrix &centroids,
+                            const SeedingComm &comm = SeedingComm());
@@ -0,0 +1,233 @@
+#include "yinyang_step.h"
+#include <limits>
+
+namespace {
+
+// Groups of about this many centroids, as proposed for Yinyang k-means
+const size_t centroidsPerGroup = 10;
+// Steps of the k-means that groups the initial centroids
+const int groupingSteps = 5;
+
+const double infinity = std::numeric_limits<double>::infinity();
+
+} // namespace
+
+YinyangStep::YinyangStep(size_t numPoints, size_t numClusters,
+                         size_t pointSize, int incrementalUpdateInterval)
+    : LloydStep(numPoints, numClusters, pointSize, incrementalUpdateInterval),
+      m_bounds{pointSize}, m_haveBounds{false},
+      m_numGroups{std::max(numClusters / centroidsPerGroup, (size_t)1)},
+      m_grouped{new std::once_flag}, m_group(numClusters),
+      m_groupStart(m_numGroups + 1), m_members(numClusters),
+      m_lower(numPoints * m_numGroups), m_drift(numClusters),
+      m_groupDrift(m_numGroups),
+      m_previousCentroids(numClusters * pointSize) {}
+
+void YinyangStep::restart() {
+    LloydStep::restart();
+    m_haveBounds = false;
+    m_grouped.reset(new std::once_flag);
+}
+
+void YinyangStep::groupCentroids(const CentroidMatrix &centroids) {
+    const size_t k = m_numClusters;
+    const size_t d = m_pointSize;
+    const size_t t = m_numGroups;
+
+    // start from evenly spaced centroids, so the grouping does not depend on
+    // (or change) the random generator
+    std::vector<double> centers(t * d);
+    for (size_t g = 0; g < t; g++)
+        std::copy(centroids[g * k / t], centroids[g * k / t] + d,
+                  centers.begin() + g * d);
+
+    std::vector<int> counts(t);
+    for (int step = 0; step < groupingSteps; step++) {
+        for (size_t i = 0; i < k; i++) {
+            double bestDist = infinity;
+            for (size_t g = 0; g < t; g++) {
+                const double dist =
+                    squaredDistance(centroids[i], centers.data() + g * d, d);
+                if (dist < bestDist) {
+                    m_group[i] = g;
+                    bestDist = dist;
+                }
+            }
+        }
+
+        // groups that lost all their centroids keep their center
+        std::fill(counts.begin(), counts.end(), 0);
+        for (size_t i = 0; i < k; i++)
+            counts[m_group[i]]++;
+        for (size_t g = 0; g < t; g++)
+            if (counts[g] > 0)
+                std::fill(centers.begin() + g * d,
+                          centers.begin() + (g + 1) * d, 0);
+        for (size_t i = 0; i < k; i++)
+            for (size_t dim = 0; dim < d; dim++)
+                centers[m_group[i] * d + dim] += centroids[i][dim];
+        for (size_t g = 0; g < t; g++)
+            for (size_t dim = 0; dim < d; dim++)
+                if (counts[g] > 0)
+                    centers[g * d + dim] /= counts[g];
+    }
+
+    // order the centroids by group, by index within a group
+    std::fill(m_groupStart.begin(), m_groupStart.end(), 0);
+    for (size_t i = 0; i < k; i++)
+        m_groupStart[m_group[i] + 1]++;
+    for (size_t g = 0; g < t; g++)
+        m_groupStart[g + 1] += m_groupStart[g];
+    std::vector<size_t> next(m_groupStart.begin(), m_groupStart.end() - 1);
+    for (size_t i = 0; i < k; i++)
+        m_members[next[m_group[i]]++] = i;
+}
+
+void YinyangStep::processChunk(size_t chunk, const KMeansKernels &kernels,
+                               const double *allData,
+                               const CentroidMatrix &centroids,
+                               int *clusters) {
+    // the first step, from the initial centroids, groups them
+    std::call_once(*m_grouped, [&] { groupCentroids(centroids); });
+
+    size_t begin, end;
+    double *sums;
+    int *counts;
+    startChunk(chunk, begin, end, sums, counts);
+
+    const size_t k = m_numClusters;
+    const size_t d = m_pointSize;
+    const size_t t = m_numGroups;
+    const bool incremental = isIncrementalStep();
+    double distSquaredSum = 0;
+    bool changed = false;
+    size_t distanceCalculations = 0;
+    std::vector<double> oldLower(t);
+
+    for (size_t pointIndex = begin; pointIndex < end; pointIndex++) {
+        const double *p = allData + pointIndex * d;
+        double *lower = m_lower.data() + pointIndex * t;
+        const int oldCluster = clusters[pointIndex];
+        int newCluster = -1;
+        double bestDist = infinity;
+
+        if (!m_haveBounds) {
+            // first step: compute all distances
+            std::fill(lower, lower + t, infinity);
+            distanceCalculations += k;
+            for (size_t i = 0; i < k; i++) {
+                const double dist = squaredDistance(p, centroids[i], d);
+                if (dist < bestDist) {
+                    if (newCluster >= 0)
+                        lower[m_group[newCluster]] =
+                            std::min(lower[m_group[newCluster]],
+                                     m_bounds.lower(bestDist));
+                    newCluster = i;
+                    bestDist = dist;
+                } else {
+                    lower[m_group[i]] =
+                        std::min(lower[m_group[i]], m_bounds.lower(dist));
+                }
+            }
+        } else {
+            double globalLower = infinity;
+            for (size_t g = 0; g < t; g++) {
+                oldLower[g] = lower[g];
+                lower[g] = m_bounds.shrink(lower[g], m_groupDrift[g]);
+                globalLower = std::min(globalLower, lower[g]);
+            }
+
+            newCluster = oldCluster;
+            bestDist = squaredDistance(p, centroids[newCluster], d);
+            distanceCalculations++;
+            const double oldDist = bestDist;
+            double upper = m_bounds.upper(bestDist);
+
+            // global filter: no group can hold a closer centroid
+            if (!(globalLower > upper)) {
+                for (size_t g = 0; g < t; g++) {
+                    // group filter
+                    if (lower[g] > upper)
+                        continue;
+
+                    double groupLower = infinity;
+                    for (size_t m = m_groupStart[g]; m < m_groupStart[g + 1];
+                         m++) {
+                        const int i = m_members[m];
+                        if (i == oldCluster)
+                            continue;
+
+                        // local filter: the centroid did not move enough to
+                        // get closer than the current one
+                        const double bound =
+                            m_bounds.shrink(oldLower[g], m_drift[i]);
+                        if (bound > upper) {
+                            groupLower = std::min(groupLower, bound);
+                            continue;
+                        }
+
+                        const double dist = squaredDistance(p, centroids[i], d);
+                        distanceCalculations++;
+                        if (dist < bestDist ||
+                            (dist == bestDist && i < newCluster)) {
+                            // the previous best is now one of the others
+                            // of its group; the old centroid is handled
+                            // below, as its group may still be scanned
+                            if (newCluster != oldCluster) {
+                                double &l = m_group[newCluster] == (int)g
+                                                ? groupLower
+                                                : lower[m_group[newCluster]];
+                                l = std::min(l, m_bounds.lower(bestDist));
+                            }
+                            newCluster = i;
+                            bestDist = dist;
+                            upper = m_bounds.upper(dist);
+                        } else {
+                            groupLower =
+                                std::min(groupLower, m_bounds.lower(dist));
+                        }
+                    }
+                    lower[g] = groupLower;
+                }
+            }
+
+            if (newCluster != oldCluster) {
+                const int g = m_group[oldCluster];
+                lower[g] = std::min(lower[g], m_bounds.lower(oldDist));
+            }
+        }
+
+        distSquaredSum += bestDist;
+
+        if (newCluster != oldCluster) {
+            clusters[pointIndex] = newCluster;
+            changed = true;
+        }
+
+        accumulatePoint(p, oldCluster, newCluster, incremental, sums, counts);
+    }
+
+    endChunk(chunk, distSquaredSum, changed, distanceCalculations);
+}
+
+bool YinyangStep::finish(CentroidMatrix &centroids,
+                         std::vector<int> &pointCounts,
+                         double &distSquaredSum) {
+    std::copy(centroids.data(), centroids.data() + m_previousCentroids.size(),
+              m_previousCentroids.begin());
+
+    if (!LloydStep::finish(centroids, pointCounts, distSquaredSum))
+        return false;
+
+    const size_t d = m_pointSize;
+    std::fill(m_groupDrift.begin(), m_groupDrift.end(), 0);
+    for (size_t i = 0; i < m_numClusters; i++) {
+        m_drift[i] = m_bounds.upper(squaredDistance(
+            m_previousCentroids.data() + i * d, centroids[i], d));
+        m_groupDrift[m_group[i]] =
+            std::max(m_groupDrift[m_group[i]], m_drift[i]);
+    }
+
+    m_haveBounds = true;
+    return true;
+}
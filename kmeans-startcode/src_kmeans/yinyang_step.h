@@ -0,0 +1,52 @@
+#pragma once
+
+#include "distance_bounds.h"
+#include "lloyd_step.h"
+#include <mutex>
+
+// Yinyang k-means: the centroids are split in groups of about ten, once, by
+// a small k-means on the initial centroids. Every point keeps an upper bound
+// on the distance to its centroid and one lower bound per group, on the
+// distance to the other centroids of that group. A point whose bounds show
+// that no group can be closer skips the step (global filter); otherwise only
+// the groups whose bound does not rule them out are scanned (group filter),
+// and in those the centroids that moved too little to have become closer are
+// skipped as well (local filter). This needs numPoints x numGroups bounds,
+// between Hamerly's one and Elkan's numClusters, and suits large k.
+//
+// As in ElkanStep, the filters use widened bounds, so the clusters,
+// centroids and step counts are the same as those of LloydStep.
+class YinyangStep : public LloydStep {
+  public:
+    YinyangStep(size_t numPoints, size_t numClusters, size_t pointSize,
+                int incrementalUpdateInterval = 0);
+
+    void processChunk(size_t chunk, const KMeansKernels &kernels,
+                      const double *allData, const CentroidMatrix &centroids,
+                      int *clusters) override;
+
+    bool finish(CentroidMatrix &centroids, std::vector<int> &pointCounts,
+                double &distSquaredSum) override;
+    void restart() override;
+
+  private:
+    void groupCentroids(const CentroidMatrix &centroids);
+
+    DistanceBounds m_bounds;
+    bool m_haveBounds;
+    size_t m_numGroups;
+    std::unique_ptr<std::once_flag> m_grouped; // new per repetition
+
+    // centroids ordered by group; those of group g are
+    // m_members[m_groupStart[g]] up to m_members[m_groupStart[g + 1]]
+    std::vector<int> m_group; // numClusters
+    std::vector<size_t> m_groupStart;
+    std::vector<int> m_members;
+
+    std::vector<double> m_lower; // numPoints x numGroups
+    // how far each centroid moved in the last step, and the furthest any
+    // centroid of each group moved
+    std::vector<double> m_drift;
+    std::vector<double> m_groupDrift;
+    std::vector<double> m_previousCentroids;
+};
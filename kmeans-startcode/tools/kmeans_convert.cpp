@@ -0,0 +1,102 @@
+#include <iostream>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "BinaryDataset.h"
+#include "MappedCSVReader.h"
+
+void usage()
+{
+	std::cerr << R"XYZ(
+Usage:
+
+  kmeans_convert input output [--dtype float64|float32] [--alignment bytes]
+
+Converts a CSV input file for the kmeans programs to the binary dataset
+format, which they can load without parsing. If the input file already is a
+binary dataset, it is converted back to CSV.
+
+Arguments:
+
+ --dtype:
+
+   Type of the stored values, 'float64' (default) or 'float32'. Float64
+   files are used in place by the kmeans programs, float32 files take half
+   the space but are converted when loading.
+
+ --alignment:
+
+   Alignment in bytes of the start of the data, a power of two. Defaults to
+   64, the size of a cache line.
+
+)XYZ";
+	exit(-1);
+}
+
+int writeCSV(const Dataset &dataset, const std::string &outputFileName)
+{
+	FILE *f = fopen(outputFileName.c_str(), "w");
+	if (!f)
+	{
+		std::cerr << "Unable to open output file " << outputFileName << std::endl;
+		return -1;
+	}
+
+	const double *p = dataset.data();
+	for (size_t r = 0 ; r < dataset.numRows() ; r++)
+	{
+		for (size_t c = 0 ; c < dataset.numCols() ; c++)
+			fprintf(f, c == 0 ? "%.17g" : ",%.17g", *p++); // round-trips exactly
+		fputc('\n', f);
+	}
+	return fclose(f) == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<std::string> args;
+	for (int i = 1 ; i < argc ; i++)
+		args.push_back(argv[i]);
+
+	if (args.size() < 2 || args.size()%2 != 0)
+		usage();
+
+	std::string inputFileName = args[0], outputFileName = args[1];
+	BinaryDatasetType dtype = BinaryFloat64;
+	size_t alignment = 64;
+	for (size_t i = 2 ; i < args.size() ; i += 2)
+	{
+		if (args[i] == "--dtype" && args[i+1] == "float64")
+			dtype = BinaryFloat64;
+		else if (args[i] == "--dtype" && args[i+1] == "float32")
+			dtype = BinaryFloat32;
+		else if (args[i] == "--alignment")
+			alignment = std::stoul(args[i+1]);
+		else
+			usage();
+	}
+
+	try
+	{
+		Dataset dataset;
+		if (isBinaryDatasetFile(inputFileName))
+		{
+			if (!dataset.openBinary(inputFileName))
+				throw std::runtime_error("Invalid binary dataset " + inputFileName);
+			return writeCSV(dataset, outputFileName);
+		}
+
+		std::vector<double> allData;
+		size_t numRows, numCols;
+		MappedCSVReader reader(inputFileName);
+		reader.read(allData, numRows, numCols);
+		writeBinaryDataset(outputFileName, allData.data(), numRows, numCols, dtype, alignment);
+		std::cerr << "Wrote " << numRows << " x " << numCols << " values to " << outputFileName << std::endl;
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,549 @@
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+#include <csignal>
+#include <fcntl.h>
+#include <memory>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "MappedCSVReader.h"
+#include "src_kmeans/distance_kernels.h"
+
+void usage()
+{
+	std::cerr << R"XYZ(
+Usage:
+
+  kmeans_predict --centroids centroids.csv [--k numclusters] [--batch maxpoints] [--socket path] [--connections N]
+
+Assigns a stream of points to the closest of a set of centroids. The points
+are CSV lines like those of the kmeans input files; for every point a line
+with the index of its closest centroid is written back. The points are
+handled in micro-batches: everything that has arrived, up to '--batch'
+points, is assigned and answered at once, so a trickle of points is answered
+right away while a burst is handled in larger batches. When the input ends,
+the latency per batch and the throughput are reported on stderr.
+
+Arguments:
+
+ --centroids:
+
+   CSV file with one centroid per line, e.g. the file written by
+   '--centroidtrace' of the kmeans programs.
+
+ --k:
+
+   Only use the last k lines of the centroids file. A '--centroidtrace' file
+   contains the centroids of every step, the last k lines are those of the
+   last step. Defaults to all lines.
+
+ --batch:
+
+   The maximum number of points per batch, 256 by default.
+
+ --socket:
+
+   Instead of reading stdin and writing stdout, listen on this Unix socket
+   and answer every connection on the connection itself. All connections
+   are served at the same time: whatever has arrived on each of them, up to
+   '--batch' points, is answered in turn, so an idle or slow client does not
+   hold up the others. A client that goes away before it has read all its
+   answers only ends its own connection. An old socket at the path is
+   replaced, any other file there is left alone and is an error.
+
+ --connections:
+
+   With '--socket', stop after this many connections have been accepted and
+   answered. Defaults to 0, which keeps serving.
+
+)XYZ";
+	exit(-1);
+}
+
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Reads whole lines from a file descriptor, without waiting when asked not to
+class LineReader
+{
+public:
+	LineReader(int fd) : m_fd(fd), m_buffer(1 << 16) { }
+
+	// Takes the next complete line (or the last one, without a newline at
+	// the end of the input). If 'wait' is false, returns false when no
+	// complete line has arrived yet; otherwise only at the end of the input.
+	bool nextLine(bool wait)
+	{
+		while (true)
+		{
+			const char *begin = m_buffer.data() + m_next;
+			const char *end = m_buffer.data() + m_end;
+			const char *newline = static_cast<const char *>(memchr(begin, '\n', end - begin));
+			if (newline || (m_eof && begin != end))
+			{
+				m_next = (newline ? newline + 1 : end) - m_buffer.data();
+				return true;
+			}
+			if (m_eof)
+				return false;
+			if (!wait)
+			{
+				pollfd p = { m_fd, POLLIN, 0 };
+				if (poll(&p, 1, 0) <= 0)
+					return false;
+			}
+			fill();
+		}
+	}
+
+	// The lines taken since the last call to consume, [begin, end)
+	void taken(const char *&begin, const char *&end) const
+	{
+		begin = m_buffer.data() + m_start;
+		end = m_buffer.data() + m_next;
+	}
+
+	// Drops the lines taken so far
+	void consume()
+	{
+		m_start = m_next;
+	}
+
+	// Whether the input ended, and whether all its lines were taken as well
+	bool ended() const
+	{
+		return m_eof;
+	}
+	bool finished() const
+	{
+		return m_eof && m_next == m_end;
+	}
+
+private:
+	void fill()
+	{
+		// move the lines not consumed yet to the front, grow if full
+		if (m_start > 0)
+		{
+			std::memmove(m_buffer.data(), m_buffer.data() + m_start, m_end - m_start);
+			m_next -= m_start;
+			m_end -= m_start;
+			m_start = 0;
+		}
+		if (m_end == m_buffer.size())
+			m_buffer.resize(m_buffer.size() * 2);
+
+		const ssize_t n = read(m_fd, m_buffer.data() + m_end, m_buffer.size() - m_end);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+			return; // nothing yet
+		if (n <= 0)
+			m_eof = true;
+		else
+			m_end += n;
+	}
+
+	int m_fd;
+	std::vector<char> m_buffer;
+	size_t m_start = 0; // first byte not consumed
+	size_t m_next = 0;  // first byte not returned
+	size_t m_end = 0;
+	bool m_eof = false;
+};
+
+// Returns false with errno set if the text could not be written
+bool writeAll(int fd, const std::string &text)
+{
+	size_t done = 0;
+	while (done < text.size())
+	{
+		const ssize_t n = write(fd, text.data() + done, text.size() - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		done += n;
+	}
+	return true;
+}
+
+struct Statistics
+{
+	size_t numPoints = 0;
+	double busySeconds = 0;   // parsing, assigning and formatting the answers
+	double assignSeconds = 0; // the kernel only
+	std::vector<double> batchSeconds;
+
+	void report() const
+	{
+		std::vector<double> latencies = batchSeconds;
+		std::sort(latencies.begin(), latencies.end());
+		auto percentile = [&latencies](double p)
+		{
+			if (latencies.empty())
+				return 0.0;
+			const size_t rank = std::max<size_t>(1, (size_t)std::ceil(p * latencies.size()));
+			return latencies[rank - 1] * 1e6;
+		};
+
+		std::cerr << "# Batches: " << latencies.size() << ", points: " << numPoints
+			  << ", latency per batch (us): p50 " << percentile(0.5)
+			  << ", p99 " << percentile(0.99) << ", max " << percentile(1.0) << std::endl;
+		if (busySeconds > 0 && assignSeconds > 0)
+			std::cerr << "# Throughput per core (points/s): " << numPoints / busySeconds
+				  << ", assignment only " << numPoints / assignSeconds << std::endl;
+	}
+};
+
+// Assigns the points of CSV lines to the closest of the centroids
+class Predictor
+{
+public:
+	Predictor(const CentroidMatrix &centroids, ClosestCentroidKernel closestCentroid)
+		: m_centroids(centroids), m_closestCentroid(closestCentroid) { }
+
+	// Appends a line with the index of the closest centroid of every point
+	// in the lines [begin, end) to 'answer', returns the number of points
+	size_t assign(const char *begin, const char *end, std::string &answer, Statistics &stats)
+	{
+		const size_t d = m_centroids.pointSize();
+		size_t numRows, numCols;
+		m_parser.parse(begin, end, m_points, numRows, numCols, 1);
+		if (numRows == 0)
+			return 0; // only comments or empty lines
+		if (numCols != d)
+			throw std::runtime_error("Points with " + std::to_string(numCols) +
+						 " values, the centroids have " + std::to_string(d));
+
+		const Clock::time_point assignStart = Clock::now();
+		m_clusters.resize(numRows);
+		for (size_t i = 0 ; i < numRows ; i++)
+		{
+			const double *point = m_points.data() + i * d;
+			double dist;
+			m_closestCentroid(point, d, m_centroids, m_clusters[i], dist);
+			if (m_clusters[i] >= 0)
+				continue;
+
+			// distances too large for the kernels
+			dist = std::numeric_limits<double>::infinity();
+			for (size_t c = 0 ; c < m_centroids.numCentroids() ; c++)
+			{
+				const double cd = squaredDistance(point, m_centroids[c], d);
+				if (cd < dist)
+				{
+					m_clusters[i] = c;
+					dist = cd;
+				}
+			}
+		}
+		stats.assignSeconds += secondsSince(assignStart);
+
+		for (int c : m_clusters)
+		{
+			answer += std::to_string(c);
+			answer += '\n';
+		}
+		return numRows;
+	}
+
+private:
+	const CentroidMatrix &m_centroids;
+	const ClosestCentroidKernel m_closestCentroid;
+	const MappedCSVReader m_parser;
+	std::vector<double> m_points;
+	std::vector<int> m_clusters;
+};
+
+// Takes the lines that have arrived on the reader, up to maxBatch, and
+// appends the answers for their points. With 'wait', waits for the first
+// line. Returns the number of lines taken, 0 if there are none (yet).
+size_t answerBatch(LineReader &reader, bool wait, size_t maxBatch, Predictor &predictor,
+		   std::string &answer, Statistics &stats)
+{
+	if (!reader.nextLine(wait))
+		return 0;
+
+	const Clock::time_point start = Clock::now();
+	size_t numLines = 1;
+	while (numLines < maxBatch && reader.nextLine(false))
+		numLines++;
+
+	const char *begin, *end;
+	reader.taken(begin, end);
+	const size_t numPoints = predictor.assign(begin, end, answer, stats);
+	reader.consume();
+	if (numPoints > 0)
+	{
+		const double seconds = secondsSince(start);
+		stats.batchSeconds.push_back(seconds);
+		stats.busySeconds += seconds;
+		stats.numPoints += numPoints;
+	}
+	return numLines;
+}
+
+// Answers the points read from 'in' on 'out', until the input ends
+void serve(int in, int out, size_t maxBatch, Predictor &predictor, Statistics &stats)
+{
+	LineReader reader(in);
+	std::string answer;
+	while (answerBatch(reader, true, maxBatch, predictor, answer, stats) > 0)
+	{
+		if (!writeAll(out, answer))
+			throw std::runtime_error(std::string("Unable to write the answer: ") + strerror(errno));
+		answer.clear();
+	}
+}
+
+// Answers a client may leave unread before its connection is not read any
+// further
+const size_t maxUnreadBytes = 1 << 20;
+
+// A client of the socket: its points, the answers it did not read yet and
+// its statistics
+struct Connection
+{
+	explicit Connection(int fd) : fd(fd), reader(fd) { }
+	~Connection() { close(fd); }
+
+	size_t unread() const { return output.size() - written; }
+
+	int fd;
+	LineReader reader;
+	std::string output;
+	size_t written = 0;
+	Statistics stats;
+};
+
+// Writes as much of the answers as the client takes without waiting.
+// Returns false if the client is gone.
+bool flush(Connection &connection)
+{
+	while (connection.unread() > 0)
+	{
+		const ssize_t n = write(connection.fd, connection.output.data() + connection.written,
+					connection.unread());
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (n < 0 && (errno == EPIPE || errno == ECONNRESET))
+			return false;
+		if (n <= 0)
+			throw std::runtime_error(std::string("Unable to write the answer: ") + strerror(errno));
+		connection.written += n;
+	}
+	if (connection.unread() == 0)
+	{
+		connection.output.clear();
+		connection.written = 0;
+	}
+	return true;
+}
+
+// Answers the connections to the listener, all at the same time, until
+// maxConnections of them (0: no limit) were accepted and have ended
+void serveConnections(int listener, long maxConnections, size_t maxBatch, Predictor &predictor)
+{
+	std::vector<std::unique_ptr<Connection>> connections;
+	long numAccepted = 0;
+	bool moreLines = false; // a connection has lines left after its batch
+
+	while (maxConnections == 0 || numAccepted < maxConnections || !connections.empty())
+	{
+		// wait for a new connection, new points or room for the answers
+		const bool accepting = maxConnections == 0 || numAccepted < maxConnections;
+		std::vector<pollfd> fds;
+		fds.push_back({ listener, (short)(accepting ? POLLIN : 0), 0 });
+		for (const auto &connection : connections)
+		{
+			short events = 0;
+			if (!connection->reader.ended() && connection->unread() < maxUnreadBytes)
+				events |= POLLIN;
+			if (connection->unread() > 0)
+				events |= POLLOUT;
+			fds.push_back({ connection->fd, events, 0 });
+		}
+		if (poll(fds.data(), fds.size(), moreLines ? 0 : -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error(std::string("Unable to wait for the connections: ") + strerror(errno));
+		}
+
+		if (fds[0].revents & POLLIN)
+		{
+			const int fd = accept(listener, nullptr, nullptr);
+			if (fd < 0)
+				throw std::runtime_error(std::string("Unable to accept a connection: ") + strerror(errno));
+			// the answers are written as far as the client takes them
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+			connections.emplace_back(new Connection(fd));
+			numAccepted++;
+		}
+
+		// a batch of what has arrived on every connection, in turn
+		moreLines = false;
+		for (size_t i = 0 ; i < connections.size() ; )
+		{
+			Connection &connection = *connections[i];
+			bool ended = false;
+
+			// a bad connection does not stop the others
+			try
+			{
+				if (connection.unread() < maxUnreadBytes &&
+				    answerBatch(connection.reader, false, maxBatch, predictor,
+						connection.output, connection.stats) == maxBatch)
+					moreLines = true;
+
+				if (!flush(connection))
+				{
+					std::cerr << "# The client closed the connection" << std::endl;
+					ended = true;
+				}
+				else
+				{
+					ended = connection.reader.finished() && connection.unread() == 0;
+				}
+			}
+			catch (const std::exception &e)
+			{
+				std::cerr << e.what() << std::endl;
+				ended = true;
+			}
+
+			if (ended)
+			{
+				connection.stats.report();
+				connections.erase(connections.begin() + i);
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+}
+
+// Whether 'path' names a socket, such as one an earlier run left behind
+bool isSocket(const std::string &path)
+{
+	struct stat status;
+	return lstat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode);
+}
+
+int listenOn(const std::string &path)
+{
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path))
+		throw std::runtime_error("Socket path too long: " + path);
+	strcpy(address.sun_path, path.c_str());
+
+	// only an old socket is replaced, never another file
+	struct stat status;
+	if (lstat(path.c_str(), &status) == 0)
+	{
+		if (!S_ISSOCK(status.st_mode))
+			throw std::runtime_error("Unable to listen on " + path + ": path exists");
+		unlink(path.c_str());
+	}
+
+	const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || bind(fd, (sockaddr *)&address, sizeof(address)) != 0 || listen(fd, 16) != 0)
+		throw std::runtime_error("Unable to listen on " + path + ": " + strerror(errno));
+	return fd;
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<std::string> args;
+	for (int i = 1 ; i < argc ; i++)
+		args.push_back(argv[i]);
+
+	if (args.size()%2 != 0)
+		usage();
+
+	std::string centroidsFileName, socketPath;
+	size_t numClusters = 0, maxBatch = 256;
+	long maxConnections = 0;
+	for (size_t i = 0 ; i < args.size() ; i += 2)
+	{
+		if (args[i] == "--centroids")
+			centroidsFileName = args[i+1];
+		else if (args[i] == "--k")
+			numClusters = std::stoul(args[i+1]);
+		else if (args[i] == "--batch")
+			maxBatch = std::max(1ul, std::stoul(args[i+1]));
+		else if (args[i] == "--socket")
+			socketPath = args[i+1];
+		else if (args[i] == "--connections")
+			maxConnections = std::stol(args[i+1]);
+		else
+			usage();
+	}
+	if (centroidsFileName.empty())
+		usage();
+
+	try
+	{
+		// the centroids: the last k lines of the file
+		std::vector<double> values;
+		size_t numRows, numCols;
+		MappedCSVReader reader(centroidsFileName);
+		reader.read(values, numRows, numCols, 1);
+		if (numClusters == 0)
+			numClusters = numRows;
+		if (numClusters > numRows)
+			throw std::runtime_error("The centroids file has fewer than " + std::to_string(numClusters) + " lines");
+
+		CentroidMatrix centroids(numClusters, numCols);
+		std::copy(values.end() - numClusters * numCols, values.end(), centroids.data());
+		centroids.updateBlocked();
+
+		const SimdLevel level = detectSimdLevel();
+		const ClosestCentroidKernel closestCentroid = getClosestCentroidKernel(level, numCols);
+		std::cerr << "# " << numClusters << " centroids of " << numCols << " values, "
+			  << simdLevelName(level) << " kernel" << std::endl;
+
+		Predictor predictor(centroids, closestCentroid);
+		if (socketPath.empty())
+		{
+			Statistics stats;
+			serve(STDIN_FILENO, STDOUT_FILENO, maxBatch, predictor, stats);
+			stats.report();
+			return 0;
+		}
+
+		// a client that disconnects early makes the writes fail with EPIPE
+		// instead of ending the server
+		signal(SIGPIPE, SIG_IGN);
+
+		const int listener = listenOn(socketPath);
+		serveConnections(listener, maxConnections, maxBatch, predictor);
+		close(listener);
+		if (isSocket(socketPath))
+			unlink(socketPath.c_str());
+	}
+	catch (const std::exception &e)
+	{
+		std::cerr << e.what() << std::endl;
+		return -1;
+	}
+	return 0;
+}
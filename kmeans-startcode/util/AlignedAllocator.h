@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Allocator for std::vector that aligns the storage to 'Alignment' bytes,
+// by default the size of a cache line.
+template<class T, size_t Alignment = 64>
+class AlignedAllocator
+{
+public:
+	typedef T value_type;
+
+	template<class U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+	AlignedAllocator() { }
+	template<class U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) { }
+
+	T *allocate(size_t n)
+	{
+		if (n == 0)
+			return nullptr;
+		void *p = nullptr;
+#ifdef _WIN32
+		p = _aligned_malloc(n * sizeof(T), Alignment);
+#else
+		if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0)
+			p = nullptr;
+#endif
+		if (!p)
+			throw std::bad_alloc();
+		return (T *)p;
+	}
+
+	void deallocate(T *p, size_t)
+	{
+#ifdef _WIN32
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+};
+
+template<class T, class U, size_t A>
+bool operator==(const AlignedAllocator<T, A> &, const AlignedAllocator<U, A> &) { return true; }
+template<class T, class U, size_t A>
+bool operator!=(const AlignedAllocator<T, A> &, const AlignedAllocator<U, A> &) { return false; }
+
+template<class T, size_t Alignment = 64>
+using AlignedVector = std::vector<T, AlignedAllocator<T, Alignment>>;
+
+// Like AlignedAllocator, but resizing a vector leaves values of trivial types
+// uninitialized. The pages of a large allocation are then only placed (on
+// the NUMA node of the thread that touches them first) where the values are
+// first written, instead of by the thread that allocates them.
+template<class T, size_t Alignment = 64>
+class UninitializedAllocator : public AlignedAllocator<T, Alignment>
+{
+public:
+	template<class U> struct rebind { typedef UninitializedAllocator<U, Alignment> other; };
+
+	UninitializedAllocator() { }
+	template<class U> UninitializedAllocator(const UninitializedAllocator<U, Alignment> &) { }
+
+	template<class U> void construct(U *p) { ::new((void *)p) U; }
+	template<class U, class... Args> void construct(U *p, Args &&... args) { ::new((void *)p) U(std::forward<Args>(args)...); }
+};
+
+template<class T, class U, size_t A>
+bool operator==(const UninitializedAllocator<T, A> &, const UninitializedAllocator<U, A> &) { return true; }
+template<class T, class U, size_t A>
+bool operator!=(const UninitializedAllocator<T, A> &, const UninitializedAllocator<U, A> &) { return false; }
+
+template<class T, size_t Alignment = 64>
+using UninitializedVector = std::vector<T, UninitializedAllocator<T, Alignment>>;
@@ -0,0 +1,177 @@
+#include "BinaryDataset.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace
+{
+
+const char datasetMagic[8] = { 'K', 'M', 'D', 'A', 'T', 'A', 0, 0 };
+const uint32_t datasetVersion = 1;
+
+size_t elementSize(uint32_t dtype)
+{
+	return dtype == BinaryFloat32 ? sizeof(float) : sizeof(double);
+}
+
+bool isValidHeader(const BinaryDatasetHeader &h, size_t fileSize)
+{
+	if (memcmp(h.magic, datasetMagic, sizeof(datasetMagic)) != 0 || h.version != datasetVersion)
+		return false;
+	if (h.dtype != BinaryFloat64 && h.dtype != BinaryFloat32)
+		return false;
+	if (h.numCols == 0 || h.dataOffset < sizeof(BinaryDatasetHeader) || h.dataOffset > fileSize)
+		return false;
+	return (fileSize - h.dataOffset) / elementSize(h.dtype) / h.numCols >= h.numRows;
+}
+
+} // namespace
+
+bool getFileStamp(const string &fileName, FileStamp &stamp)
+{
+	struct stat st;
+	if (stat(fileName.c_str(), &st) != 0)
+		return false;
+
+	stamp.size = (uint64_t)st.st_size;
+#if defined(__linux__)
+	stamp.modificationTime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#else
+	stamp.modificationTime = (int64_t)st.st_mtime * 1000000000;
+#endif
+	return true;
+}
+
+bool isBinaryDatasetFile(const string &fileName)
+{
+	ifstream f(fileName, ios::binary);
+	char magic[sizeof(datasetMagic)];
+	if (!f.read(magic, sizeof(magic)))
+		return false;
+	return memcmp(magic, datasetMagic, sizeof(datasetMagic)) == 0;
+}
+
+void writeBinaryDataset(const string &fileName, const double *data,
+                        size_t numRows, size_t numCols,
+                        BinaryDatasetType dtype, size_t alignment,
+                        const FileStamp *source)
+{
+	if (alignment < 8 || (alignment & (alignment - 1)) != 0)
+		throw runtime_error("Alignment must be a power of two of at least 8 bytes");
+
+	BinaryDatasetHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, datasetMagic, sizeof(datasetMagic));
+	h.version = datasetVersion;
+	h.dtype = dtype;
+	h.numRows = numRows;
+	h.numCols = numCols;
+	h.alignment = alignment;
+	h.dataOffset = (sizeof(h) + alignment - 1) / alignment * alignment;
+	if (source)
+	{
+		h.sourceSize = source->size;
+		h.sourceModificationTime = source->modificationTime;
+	}
+
+	string tmpName = fileName + ".tmp" +
+		to_string(chrono::steady_clock::now().time_since_epoch().count());
+	{
+		ofstream f(tmpName, ios::binary);
+		if (!f.is_open())
+			throw runtime_error("Unable to create " + tmpName);
+
+		vector<char> padding(h.dataOffset - sizeof(h), 0);
+		f.write((const char *)&h, sizeof(h));
+		f.write(padding.data(), padding.size());
+
+		if (dtype == BinaryFloat64)
+			f.write((const char *)data, numRows * numCols * sizeof(double));
+		else
+		{
+			vector<float> row(numCols);
+			for (size_t r = 0 ; r < numRows ; r++)
+			{
+				for (size_t c = 0 ; c < numCols ; c++)
+					row[c] = (float)data[r * numCols + c];
+				f.write((const char *)row.data(), numCols * sizeof(float));
+			}
+		}
+
+		if (!f.good())
+		{
+			f.close();
+			remove(tmpName.c_str());
+			throw runtime_error("Unable to write " + tmpName);
+		}
+	}
+
+	if (rename(tmpName.c_str(), fileName.c_str()) != 0)
+	{
+		remove(tmpName.c_str());
+		throw runtime_error("Unable to rename " + tmpName + " to " + fileName);
+	}
+}
+
+void Dataset::assign(vector<double> &&values, size_t numRows, size_t numCols)
+{
+	assign(std::move(values), numRows, numCols, 0);
+}
+
+void Dataset::assign(vector<double> &&values, size_t numRows, size_t numCols, size_t firstRow)
+{
+	m_file.close();
+	m_values = std::move(values);
+	m_data = m_values.data();
+	m_numRows = numRows;
+	m_numCols = numCols;
+	m_firstRow = firstRow;
+	m_lastRow = firstRow + (numCols > 0 ? m_values.size() / numCols : 0);
+}
+
+bool Dataset::openBinary(const string &fileName, const FileStamp *source)
+{
+	MappedFile file(fileName);
+
+	BinaryDatasetHeader h;
+	if (file.size() < sizeof(h))
+		return false;
+	memcpy(&h, file.data(), sizeof(h));
+	if (!isValidHeader(h, file.size()))
+		return false;
+	if (source && (h.sourceSize != source->size || h.sourceModificationTime != source->modificationTime))
+		return false;
+
+	const char *payload = file.data() + h.dataOffset;
+	m_numRows = h.numRows;
+	m_numCols = h.numCols;
+	m_firstRow = 0;
+	m_lastRow = m_numRows;
+
+	if (h.dtype == BinaryFloat64 && (uintptr_t)payload % alignof(double) == 0)
+	{
+		m_values.clear();
+		m_file = std::move(file);
+		m_data = (const double *)payload;
+	}
+	else
+	{
+		m_file.close();
+		m_values.resize(m_numRows * m_numCols);
+		if (h.dtype == BinaryFloat64)
+			memcpy(m_values.data(), payload, m_values.size() * sizeof(double));
+		else
+		{
+			const float *values = (const float *)payload;
+			for (size_t i = 0 ; i < m_values.size() ; i++)
+				m_values[i] = values[i];
+		}
+		m_data = m_values.data();
+	}
+	return true;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "MappedFile.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Compact binary dataset format: a BinaryDatasetHeader, padding up to
+// 'dataOffset' (a multiple of 'alignment'), followed by the numRows x numCols
+// values in row-major order. All fields and values are stored in the native
+// byte order of the machine that wrote the file.
+enum BinaryDatasetType : uint32_t
+{
+	BinaryFloat64 = 0,
+	BinaryFloat32 = 1,
+};
+
+struct BinaryDatasetHeader
+{
+	char magic[8];        // "KMDATA\0\0"
+	uint32_t version;
+	uint32_t dtype;       // BinaryDatasetType
+	uint64_t numRows;
+	uint64_t numCols;
+	uint64_t alignment;
+	uint64_t dataOffset;
+	// When the file caches a parsed CSV file: the size and modification time
+	// of that CSV file, zero otherwise
+	uint64_t sourceSize;
+	int64_t sourceModificationTime;
+};
+
+struct FileStamp
+{
+	uint64_t size;
+	int64_t modificationTime; // nanoseconds since the epoch where available
+};
+
+// Returns false if the file doesn't exist
+bool getFileStamp(const std::string &fileName, FileStamp &stamp);
+
+// Checks if the start of the file looks like a binary dataset
+bool isBinaryDatasetFile(const std::string &fileName);
+
+// Writes the file through a temporary name and renames it afterwards, so that
+// concurrent readers (e.g. other MPI ranks) never see a partial file. Throws
+// a std::runtime_error on failure.
+void writeBinaryDataset(const std::string &fileName, const double *data,
+                        size_t numRows, size_t numCols,
+                        BinaryDatasetType dtype = BinaryFloat64,
+                        size_t alignment = 64,
+                        const FileStamp *source = nullptr);
+
+// Row-major numRows x numCols matrix of doubles, which either owns its values
+// or points directly into a memory mapped binary dataset file. An owned
+// matrix may hold only the rows [firstRow(), lastRow()) of the dataset.
+class Dataset
+{
+public:
+	Dataset() { }
+	Dataset(const Dataset &) = delete;
+	Dataset &operator=(const Dataset &) = delete;
+	Dataset(Dataset &&) = default;
+	Dataset &operator=(Dataset &&) = default;
+
+	void assign(std::vector<double> &&values, size_t numRows, size_t numCols);
+	// Only the rows from firstRow on, as many as 'values' holds
+	void assign(std::vector<double> &&values, size_t numRows, size_t numCols, size_t firstRow);
+
+	// Uses the values of a binary dataset file. Float64 payloads are used in
+	// place, float32 payloads are converted. If 'source' is set, the file is
+	// only accepted if it was created from a file with that stamp. Returns
+	// false if the file is not a (matching) binary dataset.
+	bool openBinary(const std::string &fileName, const FileStamp *source = nullptr);
+
+	// The values of row firstRow()
+	const double *data() const { return m_data; }
+	size_t numRows() const { return m_numRows; }
+	size_t numCols() const { return m_numCols; }
+	size_t firstRow() const { return m_firstRow; }
+	size_t lastRow() const { return m_lastRow; }
+	bool isMapped() const { return m_file.is_open(); }
+private:
+	std::vector<double> m_values;
+	MappedFile m_file;
+	const double *m_data = nullptr;
+	size_t m_numRows = 0;
+	size_t m_numCols = 0;
+	size_t m_firstRow = 0;
+	size_t m_lastRow = 0;
+};
@@ -15,6 +15,7 @@ public:
 	// elements in row-major ordering, ie elements of the same row come
 	// one after the other
 	void write(const std::vector<double> &data, size_t numCols, const std::string &linePrefix = "");
+	void write(const double *data, size_t numRows, size_t numCols, const std::string &linePrefix = "");
 	template<class X> void write(const std::vector<X> &data, size_t numCols, const std::string &linePrefix = "");
 
 	template<class X> void write(const std::vector<std::vector<X>> &rows, const std::string &linePrefix = "");
@@ -89,8 +90,12 @@ inline void CSVWriter::write(const std::vector<double> &data, size_t numCols, co
 	if (data.size()%numCols != 0)
 		throw std::runtime_error("data length is not a multiple of specified number of columns");
 	
-	size_t numRows = data.size()/numCols;
-	const double *pRow = data.data();
+	write(data.data(), data.size()/numCols, numCols, linePrefix);
+}
+
+inline void CSVWriter::write(const double *data, size_t numRows, size_t numCols, const std::string &linePrefix)
+{
+	const double *pRow = data;
 	for (size_t r = 0 ; r < numRows ; r++, pRow += numCols)
 		write(pRow, numCols, linePrefix);
 }
@@ -0,0 +1,347 @@
+#include "MappedCSVReader.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+struct MappedCSVReader::Chunk
+{
+	const char *begin;
+	const char *end;
+	size_t numRows;
+	size_t rowOffset;
+	size_t badRow;       // local index of the first row with a wrong column count
+	size_t badRowCols;
+	exception_ptr error;
+};
+
+namespace
+{
+
+const size_t noRow = (size_t)-1;
+
+// Powers of ten that are exactly representable as a double
+const double exactPowersOfTen[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+// Clinger's fast path: a mantissa below 2^53 and a power of ten below 10^23
+// are both exact doubles, so a single multiplication or division yields the
+// correctly rounded result, i.e. exactly what strtod returns. Returns false
+// for everything that doesn't fit this pattern.
+bool parseSimpleDouble(const char *p, const char *end, double &x)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		p++;
+	}
+
+	uint64_t mantissa = 0;
+	int significantDigits = 0;
+	int exponent = 0;
+	bool anyDigits = false;
+
+	for ( ; p < end && isDigit(*p) ; p++)
+	{
+		anyDigits = true;
+		if (mantissa == 0 && *p == '0')
+			continue;
+		if (significantDigits == 19)
+			return false;
+		mantissa = mantissa * 10 + (*p - '0');
+		significantDigits++;
+	}
+
+	if (p < end && *p == '.')
+	{
+		for (p++ ; p < end && isDigit(*p) ; p++)
+		{
+			anyDigits = true;
+			exponent--;
+			if (mantissa == 0 && *p == '0')
+				continue;
+			if (significantDigits == 19)
+				return false;
+			mantissa = mantissa * 10 + (*p - '0');
+			significantDigits++;
+		}
+	}
+
+	if (!anyDigits)
+		return false;
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		p++;
+		bool negativeExponent = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negativeExponent = (*p == '-');
+			p++;
+		}
+		if (p == end || !isDigit(*p))
+			return false;
+
+		int e = 0;
+		for ( ; p < end && isDigit(*p) ; p++)
+		{
+			if (e > 10000)
+				return false;
+			e = e * 10 + (*p - '0');
+		}
+		exponent += negativeExponent ? -e : e;
+	}
+
+	// Only a trailing carriage return may follow the number, anything else is
+	// left to strtod so that its handling stays identical
+	if (p != end && !(*p == '\r' && p + 1 == end))
+		return false;
+
+	if (mantissa == 0)
+		x = 0;
+	else if (mantissa > ((uint64_t)1 << 53) || exponent < -22 || exponent > 22)
+		return false;
+	else if (exponent >= 0)
+		x = (double)mantissa * exactPowersOfTen[exponent];
+	else
+		x = (double)mantissa / exactPowersOfTen[-exponent];
+
+	if (negative)
+		x = -x;
+	return true;
+}
+
+// Same conversion and error conditions as std::stod
+double parseDouble(const char *begin, const char *end)
+{
+	double x;
+	if (parseSimpleDouble(begin, end, x))
+		return x;
+
+	char buffer[128];
+	string longField;
+	const char *field = buffer;
+	size_t len = end - begin;
+	if (len < sizeof(buffer))
+	{
+		memcpy(buffer, begin, len);
+		buffer[len] = 0;
+	}
+	else
+	{
+		longField.assign(begin, end);
+		field = longField.c_str();
+	}
+
+	char *parseEnd;
+	errno = 0;
+	x = strtod(field, &parseEnd);
+	if (parseEnd == field)
+		throw runtime_error("Can't convert '" + string(begin, end) + "'");
+	if (errno == ERANGE)
+		throw runtime_error("Argument is out of range for a double: '" + string(begin, end) + "'");
+	return x;
+}
+
+inline const char *findLineEnd(const char *p, const char *end)
+{
+	const char *q = (const char *)memchr(p, '\n', end - p);
+	return q ? q : end;
+}
+
+// Runs f(i) for i in [0, n), each on its own thread (the calling thread takes
+// i = 0)
+template<class F>
+void runOnThreads(size_t n, F f)
+{
+	vector<thread> threads;
+	for (size_t i = 1 ; i < n ; i++)
+		threads.emplace_back(f, i);
+	if (n > 0)
+		f(0);
+	for (auto &t : threads)
+		t.join();
+}
+
+} // namespace
+
+MappedCSVReader::MappedCSVReader(const string &fileName, char delimiter, char comment)
+	: m_file(fileName), m_delimiter(delimiter), m_comment(comment)
+{
+}
+
+MappedCSVReader::MappedCSVReader(char delimiter, char comment)
+	: m_delimiter(delimiter), m_comment(comment)
+{
+}
+
+bool MappedCSVReader::isDataLine(const char *lineStart, const char *lineEnd) const
+{
+	if (lineStart == lineEnd || *lineStart == m_comment)
+		return false;
+	// an empty line from a file with \r\n line endings
+	if (*lineStart == '\r' && lineStart + 1 == lineEnd)
+		return false;
+	return true;
+}
+
+size_t MappedCSVReader::countColumns(const char *lineStart, const char *lineEnd) const
+{
+	return count(lineStart, lineEnd, m_delimiter) + 1;
+}
+
+void MappedCSVReader::countRows(Chunk &chunk, size_t numCols) const
+{
+	chunk.numRows = 0;
+	chunk.badRow = noRow;
+
+	for (const char *p = chunk.begin ; p < chunk.end ; )
+	{
+		const char *lineEnd = findLineEnd(p, chunk.end);
+		if (isDataLine(p, lineEnd))
+		{
+			size_t cols = countColumns(p, lineEnd);
+			if (cols != numCols && chunk.badRow == noRow)
+			{
+				chunk.badRow = chunk.numRows;
+				chunk.badRowCols = cols;
+			}
+			chunk.numRows++;
+		}
+		p = lineEnd + 1;
+	}
+}
+
+void MappedCSVReader::parseRows(const Chunk &chunk, size_t numCols, double *to) const
+{
+	to += chunk.rowOffset * numCols;
+
+	for (const char *p = chunk.begin ; p < chunk.end ; )
+	{
+		const char *lineEnd = findLineEnd(p, chunk.end);
+		if (isDataLine(p, lineEnd))
+		{
+			const char *fieldStart = p;
+			for (size_t c = 0 ; c < numCols ; c++)
+			{
+				const char *fieldEnd = (const char *)memchr(fieldStart, m_delimiter, lineEnd - fieldStart);
+				if (!fieldEnd)
+					fieldEnd = lineEnd;
+
+				*to++ = parseDouble(fieldStart, fieldEnd);
+				fieldStart = fieldEnd + 1;
+			}
+		}
+		p = lineEnd + 1;
+	}
+}
+
+void MappedCSVReader::read(vector<double> &to, size_t &numRows, size_t &numCols, int numThreads)
+{
+	parse(m_file.data(), m_file.data() + m_file.size(), to, numRows, numCols, numThreads);
+	if (numCols == 0)
+		throw runtime_error("Unexpected error: 0 columns");
+}
+
+size_t MappedCSVReader::countDataLines(const char *begin, const char *end) const
+{
+	size_t numLines = 0;
+	for (const char *p = begin ; p < end ; )
+	{
+		const char *lineEnd = findLineEnd(p, end);
+		if (isDataLine(p, lineEnd))
+			numLines++;
+		p = lineEnd + 1;
+	}
+	return numLines;
+}
+
+void MappedCSVReader::parse(const char *begin, const char *end, vector<double> &to, size_t &numRows, size_t &numCols, int numThreads, size_t lineOffset) const
+{
+	// The first data line determines the number of columns
+	const char *firstLine = begin;
+	const char *firstLineEnd = begin;
+	while (firstLine < end)
+	{
+		firstLineEnd = findLineEnd(firstLine, end);
+		if (isDataLine(firstLine, firstLineEnd))
+			break;
+		firstLine = firstLineEnd + 1;
+	}
+	if (firstLine >= end)
+	{
+		to.clear();
+		numRows = numCols = 0;
+		return;
+	}
+
+	numCols = countColumns(firstLine, firstLineEnd);
+
+	// Split the file in chunks of whole lines, at least 1MB each
+	if (numThreads <= 0)
+		numThreads = max(1u, thread::hardware_concurrency());
+	size_t numChunks = min((size_t)numThreads, (size_t)(end - firstLine) / (1 << 20) + 1);
+
+	vector<Chunk> chunks(numChunks);
+	const char *chunkStart = firstLine;
+	for (size_t i = 0 ; i < numChunks ; i++)
+	{
+		const char *chunkEnd = end;
+		if (i + 1 < numChunks)
+		{
+			chunkEnd = firstLine + (end - firstLine) * (i + 1) / numChunks;
+			chunkEnd = findLineEnd(max(chunkEnd, chunkStart), end);
+			if (chunkEnd < end)
+				chunkEnd++;
+		}
+		chunks[i].begin = chunkStart;
+		chunks[i].end = chunkEnd;
+		chunkStart = chunkEnd;
+	}
+
+	// First pass: count rows per chunk and check the column counts, which
+	// gives every chunk its offset in the output
+	runOnThreads(numChunks, [&](size_t i) { countRows(chunks[i], numCols); });
+
+	numRows = 0;
+	for (auto &chunk : chunks)
+	{
+		if (chunk.badRow != noRow)
+			throw runtime_error(
+				"Incompatible number of colums read in line " +
+				to_string(lineOffset + numRows + chunk.badRow + 1) + ": expecting " +
+				to_string(numCols) + " but got " +
+				to_string(chunk.badRowCols));
+
+		chunk.rowOffset = numRows;
+		numRows += chunk.numRows;
+	}
+
+	// Second pass: parse every chunk straight into its part of the output
+	to.resize(numRows * numCols);
+	double *out = to.data();
+	runOnThreads(numChunks, [&](size_t i) {
+		try
+		{
+			parseRows(chunks[i], numCols, out);
+		}
+		catch (...)
+		{
+			chunks[i].error = current_exception();
+		}
+	});
+
+	for (auto &chunk : chunks)
+		if (chunk.error)
+			rethrow_exception(chunk.error);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "MappedFile.h"
+#include <string>
+#include <vector>
+
+// Reads a complete CSV file of numbers in one go. The file is memory mapped,
+// split into chunks of whole lines and the chunks are parsed in parallel,
+// directly into the (presized) output vector.
+//
+// Like CSVReader, empty lines and lines starting with the comment character
+// are skipped, and every other line must have the same number of columns.
+// The numbers are converted to exactly the same doubles as std::stod would
+// produce: simple decimals take an exact fast path, anything else is handed
+// to strtod.
+class MappedCSVReader
+{
+public:
+	MappedCSVReader(const std::string &fileName, char delimiter = ',', char comment = '#');
+	// Without a file, only to use parse()
+	MappedCSVReader(char delimiter = ',', char comment = '#');
+
+	// Fills 'to' with all values in row-major order. Throws a
+	// std::runtime_error on inconsistent column counts or invalid numbers.
+	// A 'numThreads' of 0 uses all available cores.
+	void read(std::vector<double> &to, size_t &numRows, size_t &numCols, int numThreads = 0);
+
+	// Like read, for the whole lines in [begin, end), e.g. a part of a file
+	// that was read in another way. Text without data lines gives 0 rows and
+	// 0 columns instead of an error. 'lineOffset' is the number of data lines
+	// before 'begin', which the line numbers in the errors start after.
+	void parse(const char *begin, const char *end, std::vector<double> &to, size_t &numRows, size_t &numCols, int numThreads = 0, size_t lineOffset = 0) const;
+
+	// The number of lines in [begin, end) that parse turns into rows
+	size_t countDataLines(const char *begin, const char *end) const;
+private:
+	struct Chunk;
+
+	size_t countColumns(const char *lineStart, const char *lineEnd) const;
+	bool isDataLine(const char *lineStart, const char *lineEnd) const;
+	void countRows(Chunk &chunk, size_t numCols) const;
+	void parseRows(const Chunk &chunk, size_t numCols, double *to) const;
+
+	MappedFile m_file;
+	const char m_delimiter;
+	const char m_comment;
+};
@@ -0,0 +1,105 @@
+#include "MappedFile.h"
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPEDFILE_USE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+MappedFile::MappedFile(MappedFile &&other)
+{
+	*this = std::move(other);
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other)
+{
+	if (this != &other)
+	{
+		close();
+		m_buffer = std::move(other.m_buffer);
+		m_data = other.m_mapped ? other.m_data : m_buffer.data();
+		m_size = other.m_size;
+		m_open = other.m_open;
+		m_mapped = other.m_mapped;
+
+		other.m_data = nullptr;
+		other.m_size = 0;
+		other.m_open = false;
+		other.m_mapped = false;
+	}
+	return *this;
+}
+
+void MappedFile::open(const string &fileName)
+{
+	close();
+
+#ifdef MAPPEDFILE_USE_MMAP
+	int fd = ::open(fileName.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw runtime_error("Unable to open input file " + fileName);
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		::close(fd);
+		throw runtime_error("Unable to determine size of input file " + fileName);
+	}
+
+	m_size = (size_t)st.st_size;
+	if (m_size > 0)
+	{
+		void *p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED)
+		{
+			// the file is parsed front to back, let the kernel read ahead
+			madvise(p, m_size, MADV_SEQUENTIAL);
+			madvise(p, m_size, MADV_WILLNEED);
+			m_data = (const char *)p;
+			m_mapped = true;
+		}
+	}
+	::close(fd); // the mapping stays valid after closing the descriptor
+
+	if (m_mapped || m_size == 0)
+	{
+		m_open = true;
+		return;
+	}
+#endif
+
+	// Fallback: read the whole file into memory
+	ifstream f(fileName, ios::binary | ios::ate);
+	if (!f.is_open())
+		throw runtime_error("Unable to open input file " + fileName);
+
+	m_size = (size_t)f.tellg();
+	m_buffer.resize(m_size);
+	f.seekg(0);
+	if (m_size > 0 && !f.read(m_buffer.data(), m_size))
+		throw runtime_error("Unable to read input file " + fileName);
+
+	m_data = m_buffer.data();
+	m_open = true;
+}
+
+void MappedFile::close()
+{
+#ifdef MAPPEDFILE_USE_MMAP
+	if (m_mapped)
+		munmap((void *)m_data, m_size);
+#endif
+	m_buffer.clear();
+	m_buffer.shrink_to_fit();
+	m_data = nullptr;
+	m_size = 0;
+	m_open = false;
+	m_mapped = false;
+}
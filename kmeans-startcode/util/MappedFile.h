@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// Read-only view on the contents of a file. On POSIX systems the file is
+// memory mapped, elsewhere it is read into an internal buffer, so callers
+// only have to deal with a (pointer, size) pair.
+class MappedFile
+{
+public:
+	MappedFile() { }
+	MappedFile(const std::string &fileName) { open(fileName); }
+	~MappedFile() { close(); }
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+	MappedFile(MappedFile &&other);
+	MappedFile &operator=(MappedFile &&other);
+
+	// Throws a std::runtime_error if the file can't be opened
+	void open(const std::string &fileName);
+	void close();
+
+	bool is_open() const { return m_open; }
+	const char *data() const { return m_data; }
+	size_t size() const { return m_size; }
+private:
+	const char *m_data = nullptr;
+	size_t m_size = 0;
+	bool m_open = false;
+	bool m_mapped = false;
+	std::vector<char> m_buffer; // only used when the file could not be mapped
+};
@@ -1,11 +1,12 @@
 #include "rng.h"
 #include <cstdlib>
 #include <iostream>
+#include <set>
 
 using namespace std;
 
-Rng::Rng(unsigned long seed)
-	: m_rng(seed), m_seed(seed)
+Rng::Rng(unsigned long seed, bool legacy)
+	: m_rng(seed), m_seed(seed), m_legacy(legacy)
 {
 }
 
@@ -13,8 +14,7 @@ Rng::~Rng()
 {
 }
 
-// Algorithm from gsl_ran_choose (https://github.com/ampl/gsl/blob/master/randist/shuffle.c)
-void Rng::pickRandomIndices(size_t n, std::vector<size_t> &indices)
+void Rng::pickRandomIndices(size_t repetition, size_t n, std::vector<size_t> &indices)
 {
 	if (indices.size() > n)
 	{
@@ -22,6 +22,28 @@ void Rng::pickRandomIndices(size_t n, std::vector<size_t> &indices)
 		exit(-1);
 	}
 
+	if (m_legacy)
+	{
+		pickLegacyIndices(n, indices);
+		return;
+	}
+
+	// Floyd's algorithm: one draw per index, so O(c log c) instead of
+	// walking all n numbers
+	PhiloxStream random = stream(repetition);
+	set<size_t> chosen;
+	for (size_t j = n - indices.size(); j < n; j++)
+	{
+		const size_t t = random.nextBelow(j + 1);
+		if (!chosen.insert(t).second)
+			chosen.insert(j);
+	}
+	copy(chosen.begin(), chosen.end(), indices.begin());
+}
+
+// Algorithm from gsl_ran_choose (https://github.com/ampl/gsl/blob/master/randist/shuffle.c)
+void Rng::pickLegacyIndices(size_t n, std::vector<size_t> &indices)
+{
 	for (size_t i = 0, j = 0 ; i < n && j < indices.size(); i++)
 	{
 		uniform_int_distribution<> dist(0, n-i-1);
@@ -32,3 +54,62 @@ void Rng::pickRandomIndices(size_t n, std::vector<size_t> &indices)
 		}
 	}
 }
+
+PhiloxStream::PhiloxStream(uint64_t key, uint64_t stream)
+	: m_stream(stream), m_counter(0), m_used(4)
+{
+	m_key[0] = (uint32_t)key;
+	m_key[1] = (uint32_t)(key >> 32);
+}
+
+// Philox4x32-10 of the counter (position, stream)
+void PhiloxStream::generate(uint64_t position, uint32_t block[4]) const
+{
+	uint32_t c[4] = { (uint32_t)position, (uint32_t)(position >> 32),
+	                  (uint32_t)m_stream, (uint32_t)(m_stream >> 32) };
+	uint32_t k[2] = { m_key[0], m_key[1] };
+	for (int round = 0; round < 10; round++)
+	{
+		const uint64_t p0 = (uint64_t)0xD2511F53 * c[0];
+		const uint64_t p1 = (uint64_t)0xCD9E8D57 * c[2];
+		const uint32_t next[4] = { (uint32_t)(p1 >> 32) ^ c[1] ^ k[0], (uint32_t)p1,
+		                           (uint32_t)(p0 >> 32) ^ c[3] ^ k[1], (uint32_t)p0 };
+		copy(next, next + 4, c);
+		k[0] += 0x9E3779B9;
+		k[1] += 0xBB67AE85;
+	}
+	copy(c, c + 4, block);
+}
+
+uint64_t PhiloxStream::next()
+{
+	if (m_used == 4)
+	{
+		generate(m_counter, m_block);
+		m_counter++;
+		m_used = 0;
+	}
+
+	const uint64_t r = ((uint64_t)m_block[m_used] << 32) | m_block[m_used + 1];
+	m_used += 2;
+	return r;
+}
+
+double PhiloxStream::uniformAt(uint64_t position) const
+{
+	uint32_t block[4];
+	generate(position, block);
+	return ((((uint64_t)block[0] << 32) | block[1]) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+uint64_t PhiloxStream::nextBelow(uint64_t n)
+{
+	// reject the top numbers that would make some results more likely
+	const uint64_t limit = UINT64_MAX - UINT64_MAX % n;
+	uint64_t r;
+	do
+	{
+		r = next();
+	} while (r >= limit);
+	return r % n;
+}
@@ -1,12 +1,48 @@
 #pragma once
 
+#include <cstdint>
 #include <random>
 #include <vector>
 
+// A counter based random number generator: the numbers are a function of
+// the key (the seed), the stream and their position in it, so a stream can
+// be started anywhere without generating the numbers before it.
+class PhiloxStream
+{
+public:
+	PhiloxStream(uint64_t key, uint64_t stream);
+
+	uint64_t next();
+
+	// A uniformly distributed number between 0 and n-1
+	uint64_t nextBelow(uint64_t n);
+
+	// A uniformly distributed number in [0, 1)
+	double nextDouble() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+	// A uniformly distributed number in [0, 1) taken directly from block
+	// 'position' of the stream, without changing the position of next()
+	double uniformAt(uint64_t position) const;
+private:
+	void generate(uint64_t position, uint32_t block[4]) const;
+
+	uint32_t m_key[2];
+	uint64_t m_stream;
+	uint64_t m_counter;
+	uint32_t m_block[4];
+	int m_used;
+};
+
 class Rng
 {
 public:
-    Rng(unsigned long seed);
+	// By default the random numbers come from a counter based generator
+	// (Philox4x32-10): every repetition has its own stream, so its initial
+	// centroids can be picked on any thread or rank, in any order. With
+	// 'legacy' set, a single std::mt19937 is used, which reproduces the
+	// sequence of earlier versions as long as the repetitions draw their
+	// indices one after the other.
+    Rng(unsigned long seed, bool legacy = false);
     ~Rng();
 
 	// Fills 'indices' (so should already have a specific size) with
@@ -14,11 +50,21 @@ public:
 	// algorithm to pick the initial points: if there are n points
 	// and c initial centroids need to be chosen, create a vector
 	// with c entries, and call this function. The vector will then
-	// contain the random indices of the points to use.
-    void pickRandomIndices(size_t n, std::vector<size_t> &indices);
+	// contain the random indices of the points to use, in increasing
+	// order. The numbers are taken from the stream of 'repetition';
+	// in legacy mode that is ignored and the calls must be made in
+	// the order of the repetitions.
+    void pickRandomIndices(size_t repetition, size_t n, std::vector<size_t> &indices);
+
+	// The counter based stream 'id' for this seed, also in legacy mode
+	PhiloxStream stream(uint64_t id) const { return PhiloxStream(m_seed, id); }
 
+	bool isLegacy() const { return m_legacy; }
 	unsigned long getUsedSeed() const { return m_seed; }
 private:
+	void pickLegacyIndices(size_t n, std::vector<size_t> &indices);
+
     std::mt19937 m_rng;
 	unsigned long m_seed;
+	bool m_legacy;
 };